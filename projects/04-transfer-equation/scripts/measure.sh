@@ -2,7 +2,7 @@
 
 MAX_PROC=$(lscpu | awk -F ":" '/Core/ { c=$2; }; /Socket/ { print c*$2 }' )
 SAMPLES=512
-PARAMS="--h 0.001 --tau 0.01 --t 50.0 --b 1.0"
+PARAMS="--h 0.001 --tau 0.01 --t 50.0 --b 1.0 --storage rolling"
 
 echo "# 'n, number processes' 'time (serial), ms' 'time (mpi)' 'ratio' 'eff'" > "${OUT_BASENAME}"
 
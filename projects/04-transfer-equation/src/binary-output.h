@@ -0,0 +1,53 @@
+// Copyright (c) 2024 Sergei Zimmerman
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
+namespace transfer {
+
+// Header of the binary solver output. It is followed by the row-major
+// (t_dim, x_dim) grid of `element_size` byte values, sampled every `tau` in
+// time and every `h` in x. Rows without a uniform step, those of an adaptive
+// time axis or of a time stride that doesn't divide it, have a `tau` of 0
+// and the grid is followed by the t_dim times of its rows as doubles.
+// Everything is stored in the native byte order.
+struct output_header {
+  static constexpr auto expected_magic =
+      std::array<char, 8>{'t', 'r', 'a', 'n', 's', 'f', 'e', 'r'};
+
+  std::array<char, 8> magic = expected_magic;
+  std::uint64_t element_size;
+  std::uint64_t t_dim;
+  std::uint64_t x_dim;
+  double a;
+  double b;
+  double tau;
+  double h;
+};
+
+static_assert(std::is_trivially_copyable_v<output_header>);
+static_assert(sizeof(output_header) == 64, "header must have no padding");
+
+} // namespace transfer
@@ -0,0 +1,261 @@
+// Copyright (c) 2024 Sergei Zimmerman
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#pragma once
+
+#include <boost/mpi.hpp>
+#include <boost/serialization/vector.hpp>
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace transfer {
+
+// Every process keeps two checkpoint slots, `<prefix>.<rank>.0` and
+// `<prefix>.<rank>.1`, and writes them in turn, so the previous checkpoint
+// stays intact while the next one is written. A slot is the header, the raw
+// state and the magic again. The trailing magic is written last, so a slot
+// that was being written when the job got killed is ignored.
+struct checkpoint_header {
+  static constexpr auto expected_magic =
+      std::array<char, 8>{'c', 'h', 'e', 'c', 'k', 'p', 'n', 't'};
+
+  std::array<char, 8> magic = expected_magic;
+  std::uint64_t level;
+  // Identifies the problem and the part of it owned by the process.
+  std::uint64_t fingerprint;
+  std::uint64_t size;
+};
+
+// FNV-1a hash of `values`, used as a checkpoint fingerprint.
+inline auto hash_values(std::initializer_list<std::uint64_t> values)
+    -> std::uint64_t {
+  auto hash = std::uint64_t{14695981039346656037u};
+  for (auto value : values) {
+    for (auto byte = 0; byte < 8; ++byte) {
+      hash ^= (value >> (byte * 8)) & 0xff;
+      hash *= 1099511628211u;
+    }
+  }
+  return hash;
+}
+
+// FNV-1a hash of the bytes of `text`.
+inline auto hash_text(std::string_view text) -> std::uint64_t {
+  auto hash = std::uint64_t{14695981039346656037u};
+  for (auto character : text) {
+    hash ^= static_cast<unsigned char>(character);
+    hash *= 1099511628211u;
+  }
+  return hash;
+}
+
+inline auto checkpoint_path(const std::string &prefix, int rank, int slot)
+    -> std::string {
+  return fmt::format("{}.{}.{}", prefix, rank, slot);
+}
+
+// Header of the slot if it is complete and was written with `fingerprint`.
+inline auto read_checkpoint_header(const std::string &path,
+                                   std::uint64_t fingerprint)
+    -> std::optional<checkpoint_header> {
+  auto file = std::ifstream{path, std::ios::binary};
+  auto header = checkpoint_header{};
+  if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      header.magic != checkpoint_header::expected_magic ||
+      header.fingerprint != fingerprint)
+    return std::nullopt;
+
+  auto trailer = std::array<char, 8>{};
+  file.seekg(static_cast<std::streamoff>(sizeof(header) + header.size));
+  if (!file.read(trailer.data(), trailer.size()) ||
+      trailer != checkpoint_header::expected_magic)
+    return std::nullopt;
+  return header;
+}
+
+// Reads the state of `level` from the slot that holds it.
+inline void read_checkpoint(const std::string &prefix, int rank,
+                            std::uint64_t level, std::uint64_t fingerprint,
+                            std::span<std::byte> state) {
+  for (auto slot : {0, 1}) {
+    auto path = checkpoint_path(prefix, rank, slot);
+    auto header = read_checkpoint_header(path, fingerprint);
+    if (!header || header->level != level || header->size != state.size())
+      continue;
+    auto file = std::ifstream{path, std::ios::binary};
+    file.seekg(sizeof(checkpoint_header));
+    if (file.read(reinterpret_cast<char *>(state.data()),
+                  static_cast<std::streamsize>(state.size())))
+      return;
+  }
+  throw std::runtime_error{fmt::format(
+      "can't read the checkpoint of level {} of process {}", level, rank)};
+}
+
+// Latest level that every process of `world` has a complete checkpoint of.
+inline auto find_latest_checkpoint(const boost::mpi::communicator &world,
+                                   const std::string &prefix,
+                                   std::uint64_t fingerprint)
+    -> std::optional<std::uint64_t> {
+  auto levels = std::vector<std::uint64_t>{};
+  for (auto slot : {0, 1}) {
+    auto header = read_checkpoint_header(
+        checkpoint_path(prefix, world.rank(), slot), fingerprint);
+    if (header)
+      levels.push_back(header->level);
+  }
+
+  // Any consistent level is one of the levels of the first process.
+  auto candidates = levels;
+  boost::mpi::broadcast(world, candidates, 0);
+  std::ranges::sort(candidates, std::ranges::greater{});
+  for (auto level : candidates) {
+    auto has_level = static_cast<int>(std::ranges::count(levels, level));
+    auto everyone_has_level = 0;
+    boost::mpi::all_reduce(world, has_level, everyone_has_level,
+                           boost::mpi::minimum<int>{});
+    if (everyone_has_level)
+      return level;
+  }
+  return std::nullopt;
+}
+
+// Writes the checkpoints of one process on a background thread. The caller
+// hands over a copy of the state and goes on stepping, the next `write` waits
+// for the previous one to finish. Errors of the background thread are
+// rethrown from `write` and `wait`.
+class checkpoint_writer {
+public:
+  // A new run starts with empty slots. A resumed one keeps the slot it
+  // resumed from until the next checkpoint is complete.
+  checkpoint_writer(std::string path_prefix, int process_rank,
+                    std::uint64_t run_fingerprint,
+                    std::optional<std::uint64_t> resumed_level)
+      : prefix(std::move(path_prefix)), rank(process_rank),
+        fingerprint(run_fingerprint) {
+    for (auto slot : {0, 1}) {
+      auto path = checkpoint_path(prefix, rank, slot);
+      if (!resumed_level) {
+        std::filesystem::remove(path);
+        continue;
+      }
+      auto header = read_checkpoint_header(path, fingerprint);
+      if (header && header->level == *resumed_level)
+        next_slot = 1 - slot;
+    }
+    worker = std::jthread{[this](std::stop_token stop) { work(stop); }};
+  }
+
+  checkpoint_writer(const checkpoint_writer &) = delete;
+  checkpoint_writer &operator=(const checkpoint_writer &) = delete;
+
+  ~checkpoint_writer() {
+    auto lock = std::unique_lock{mutex};
+    written.wait(lock, [&] { return !pending; });
+  }
+
+  void write(std::uint64_t level, std::vector<std::byte> state) {
+    wait();
+    auto lock = std::unique_lock{mutex};
+    pending_level = level;
+    pending_state = std::move(state);
+    pending = true;
+    requested.notify_one();
+  }
+
+  void wait() {
+    auto lock = std::unique_lock{mutex};
+    written.wait(lock, [&] { return !pending; });
+    if (error)
+      std::rethrow_exception(std::exchange(error, nullptr));
+  }
+
+private:
+  void work(std::stop_token stop) {
+    auto lock = std::unique_lock{mutex};
+    while (requested.wait(lock, stop, [&] { return pending; })) {
+      lock.unlock();
+      auto failure = std::exception_ptr{};
+      try {
+        store();
+      } catch (...) {
+        failure = std::current_exception();
+      }
+      lock.lock();
+      error = failure;
+      next_slot = 1 - next_slot;
+      pending = false;
+      written.notify_all();
+    }
+  }
+
+  void store() {
+    auto path = checkpoint_path(prefix, rank, next_slot);
+    auto file = std::ofstream{path, std::ios::binary | std::ios::trunc};
+    auto header = checkpoint_header{.level = pending_level,
+                                    .fingerprint = fingerprint,
+                                    .size = pending_state.size()};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(pending_state.data()),
+               static_cast<std::streamsize>(pending_state.size()));
+    file.write(checkpoint_header::expected_magic.data(),
+               checkpoint_header::expected_magic.size());
+    file.close();
+    if (!file)
+      throw std::runtime_error{
+          fmt::format("failed to write the checkpoint {}", path)};
+  }
+
+  std::string prefix;
+  int rank;
+  std::uint64_t fingerprint;
+  int next_slot = 0;
+
+  std::mutex mutex;
+  std::condition_variable_any requested;
+  std::condition_variable written;
+  bool pending = false;
+  std::uint64_t pending_level = 0;
+  std::vector<std::byte> pending_state;
+  std::exception_ptr error;
+  std::jthread worker;
+};
+
+} // namespace transfer
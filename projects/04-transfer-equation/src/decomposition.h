@@ -0,0 +1,134 @@
+// Copyright (c) 2024 Sergei Zimmerman
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#pragma once
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace transfer {
+
+// Points [first, first + size) of a one-dimensional grid owned by a process.
+struct index_range {
+  std::size_t first;
+  std::size_t size;
+};
+
+// Splits `count` points into `parts` contiguous ranges whose sizes differ by
+// at most one point. Returns the range of part `index`.
+inline auto split_evenly(std::size_t count, std::size_t parts,
+                         std::size_t index) -> index_range {
+  auto base = count / parts;
+  auto remainder = count % parts;
+  return {index * base + std::min(index, remainder),
+          base + (index < remainder ? 1 : 0)};
+}
+
+// Splits `count` points into contiguous ranges proportional to `weights`,
+// e.g. the measured throughput of every process. The points left after
+// rounding down go to the largest fractional parts. Parts with zero weight
+// get no points.
+inline auto split_weighted(std::size_t count, std::span<const double> weights)
+    -> std::vector<index_range> {
+  if (std::ranges::any_of(weights, [](auto w) { return !(w >= 0); }))
+    throw std::invalid_argument{"process weights must be non-negative"};
+  auto total = std::accumulate(weights.begin(), weights.end(), 0.0);
+  if (!(total > 0))
+    throw std::invalid_argument{
+        "at least one process weight must be positive"};
+
+  auto sizes = std::vector<std::size_t>(weights.size());
+  auto fractions = std::vector<double>(weights.size());
+  auto assigned = std::size_t{0};
+  for (auto i = std::size_t{0}; i < weights.size(); ++i) {
+    auto share = static_cast<double>(count) * weights[i] / total;
+    sizes[i] = std::min(static_cast<std::size_t>(std::floor(share)),
+                        count - assigned);
+    fractions[i] = share - static_cast<double>(sizes[i]);
+    assigned += sizes[i];
+  }
+
+  auto order = std::vector<std::size_t>(weights.size());
+  std::iota(order.begin(), order.end(), std::size_t{0});
+  std::ranges::stable_sort(order, [&](auto lhs, auto rhs) {
+    return fractions[lhs] > fractions[rhs];
+  });
+  for (auto i : order) {
+    if (assigned == count)
+      break;
+    if (weights[i] > 0) {
+      ++sizes[i];
+      ++assigned;
+    }
+  }
+
+  auto ranges = std::vector<index_range>(weights.size());
+  auto first = std::size_t{0};
+  for (auto i = std::size_t{0}; i < weights.size(); ++i) {
+    ranges[i] = {first, sizes[i]};
+    first += sizes[i];
+  }
+  return ranges;
+}
+
+// Ranges of all `parts` processes: proportional to `weights` if there are
+// any, one per process, and even otherwise.
+inline auto decompose(std::size_t count, std::size_t parts,
+                      std::span<const double> weights)
+    -> std::vector<index_range> {
+  if (weights.empty()) {
+    auto ranges = std::vector<index_range>(parts);
+    for (auto i = std::size_t{0}; i < parts; ++i)
+      ranges[i] = split_evenly(count, parts, i);
+    return ranges;
+  }
+  if (weights.size() != parts)
+    throw std::invalid_argument{fmt::format(
+        "expected {} process weights, got {}", parts, weights.size())};
+  return split_weighted(count, weights);
+}
+
+// Reads whitespace separated process weights from a speed file.
+inline auto read_weights(const std::string &path) -> std::vector<double> {
+  auto file = std::ifstream{path};
+  if (!file)
+    throw std::runtime_error{
+        fmt::format("can't open the weights file: {}", path)};
+
+  auto weights = std::vector<double>{};
+  for (auto weight = 0.0; file >> weight;)
+    weights.push_back(weight);
+  if (!file.eof())
+    throw std::runtime_error{
+        fmt::format("malformed weights file: {}", path)};
+  return weights;
+}
+
+} // namespace transfer
@@ -0,0 +1,619 @@
+// Copyright (c) 2024 Sergei Zimmerman
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#pragma once
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <numbers>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace transfer {
+
+// Values of one variable in a batched evaluation: `values[k * stride]` for
+// point k, a stride of zero gives every point the same value.
+template <std::floating_point T> struct batch_argument {
+  const T *values;
+  std::size_t stride;
+
+  static auto varying(std::span<const T> values) -> batch_argument {
+    return {values.data(), 1};
+  }
+
+  static auto uniform(const T &value) -> batch_argument { return {&value, 0}; }
+};
+
+// Arithmetic expression of named variables such as `cos(pi * x) + t`, parsed
+// once into postfix bytecode for a stack machine. It knows + - * / ^, unary
+// minus, the constants pi and e, the functions sin, cos, tan, asin, acos,
+// atan, sinh, cosh, tanh, exp, log, sqrt, abs and the two argument min, max
+// and pow. Subexpressions of constants are folded while parsing.
+//
+// The batched `evaluate` runs every instruction over a chunk of points at
+// once, so the interpretation overhead is paid per chunk rather than per
+// point. Values that are the same for the whole chunk, e.g. everything that
+// depends only on t when a row of x points is evaluated, are computed once.
+template <std::floating_point T> class expression {
+public:
+  // Deepest stack an expression may need.
+  static constexpr std::size_t max_depth = 32;
+  // Points evaluated per instruction by the batched `evaluate`.
+  static constexpr std::size_t chunk_size = 256;
+
+  expression(std::string_view text, std::vector<std::string> variable_names)
+      : source(text), variables(std::move(variable_names)) {
+    auto parser = expression_parser{*this, text};
+    parser.parse();
+  }
+
+  auto text() const -> const std::string & { return source; }
+
+  auto depends_on(std::size_t variable) const -> bool {
+    return std::ranges::any_of(code, [&](const instruction &step) {
+      return step.op == opcode::variable && step.index == variable;
+    });
+  }
+
+  // Index of the variable if the expression is just a variable.
+  auto as_variable() const -> std::optional<std::size_t> {
+    if (code.size() != 1 || code.front().op != opcode::variable)
+      return std::nullopt;
+    return code.front().index;
+  }
+
+  // Splits the expression into its largest subexpressions that read only the
+  // variables of the `fixed` bit mask, so they can be evaluated ahead of
+  // time, and the rest, which reads the value of part k as the variable
+  // `num_variables + k` after its own variables. Evaluating the parts and
+  // then the rest performs the same operations as evaluating the expression.
+  auto split(std::uint64_t fixed) const
+      -> std::pair<std::vector<expression>, expression> {
+    // Where the code of the subexpression ending at every instruction starts
+    // and the mask of the variables it reads.
+    struct node {
+      std::size_t first;
+      std::uint64_t reads;
+    };
+    auto nodes = std::vector<node>(code.size());
+    auto roots = std::vector<std::size_t>{};
+    for (auto k = std::size_t{0}; k < code.size(); ++k) {
+      auto &&step = code[k];
+      if (arity(step.op) == 0) {
+        nodes[k] = {k, step.op == opcode::variable
+                           ? std::uint64_t{1} << step.index
+                           : std::uint64_t{0}};
+        roots.push_back(k);
+        continue;
+      }
+      auto reads = std::uint64_t{0};
+      for (auto i = std::size_t{0}; i < arity(step.op); ++i) {
+        nodes[k].first = nodes[roots.back()].first;
+        reads |= nodes[roots.back()].reads;
+        roots.pop_back();
+      }
+      nodes[k].reads = reads;
+      roots.push_back(k);
+    }
+
+    auto parts = std::vector<expression>{};
+    auto rest = std::vector<instruction>{};
+    auto visit = [&](auto &self, std::size_t k) -> void {
+      auto [first, reads] = nodes[k];
+      if (first == k) {
+        rest.push_back(code[k]);
+        return;
+      }
+      if (reads != 0 && (reads & ~fixed) == 0) {
+        rest.push_back({.op = opcode::variable,
+                        .index = variables.size() + parts.size()});
+        parts.push_back(expression{
+            source, variables,
+            std::span<const instruction>{code}.subspan(first, k + 1 - first)});
+        return;
+      }
+      if (arity(code[k].op) == 2)
+        self(self, nodes[k - 1].first - 1);
+      self(self, k - 1);
+      rest.push_back(code[k]);
+    };
+    visit(visit, code.size() - 1);
+
+    auto rest_variables = variables;
+    for (auto k = std::size_t{0}; k < parts.size(); ++k)
+      rest_variables.push_back(fmt::format("part {}", k));
+    return {std::move(parts), expression{source, std::move(rest_variables),
+                                         std::span<const instruction>{rest}}};
+  }
+
+  // Value at one point, the arguments follow the order of the variables.
+  template <std::convertible_to<T>... Args>
+  auto operator()(Args... args) const -> T {
+    auto values = std::array<T, sizeof...(Args)>{static_cast<T>(args)...};
+    return evaluate(std::span<const T>{values});
+  }
+
+  auto evaluate(std::span<const T> values) const -> T {
+    check_arity(values.size());
+    auto stack = std::array<T, max_depth>{};
+    auto top = std::size_t{0};
+    for (auto &&step : code) {
+      switch (step.op) {
+      case opcode::constant:
+        stack[top++] = step.value;
+        break;
+      case opcode::variable:
+        stack[top++] = values[step.index];
+        break;
+      default:
+        if (arity(step.op) == 1) {
+          visit_unary(step.op,
+                      [&](auto f) { stack[top - 1] = f(stack[top - 1]); });
+        } else {
+          --top;
+          visit_binary(step.op, [&](auto f) {
+            stack[top - 1] = f(stack[top - 1], stack[top]);
+          });
+        }
+      }
+    }
+    return stack[0];
+  }
+
+  // Values at `result.size()` points, one argument per variable.
+  void evaluate(std::span<const batch_argument<T>> arguments,
+                std::span<T> result) const {
+    check_arity(arguments.size());
+    thread_local auto registers = std::vector<T>{};
+    registers.resize(depth * chunk_size);
+    auto slot = [&](std::size_t i) {
+      return registers.data() + i * chunk_size;
+    };
+
+    // Contiguous arguments are read in place and the last instruction writes
+    // into the result, so the stack only holds the intermediate values.
+    struct operand {
+      const T *values;
+      bool uniform;
+    };
+    auto stack = std::array<operand, max_depth>{};
+    for (auto first = std::size_t{0}; first < result.size();
+         first += chunk_size) {
+      auto count = std::min(chunk_size, result.size() - first);
+      auto output = result.subspan(first, count);
+      auto top = std::size_t{0};
+      for (auto &&step : code) {
+        auto is_last = &step == &code.back();
+        switch (step.op) {
+        case opcode::constant:
+          stack[top++] = {&step.value, true};
+          break;
+        case opcode::variable: {
+          auto argument = arguments[step.index];
+          auto input = argument.values + first * argument.stride;
+          if (argument.stride <= 1) {
+            stack[top++] = {input, argument.stride == 0};
+            break;
+          }
+          auto values = slot(top);
+          for (auto k = std::size_t{0}; k < count; ++k)
+            values[k] = input[k * argument.stride];
+          stack[top++] = {values, false};
+          break;
+        }
+        default:
+          if (arity(step.op) == 1) {
+            auto [values, uniform] = stack[top - 1];
+            auto width = uniform ? std::size_t{1} : count;
+            auto out = is_last && !uniform ? output.data() : slot(top - 1);
+            visit_unary(step.op, [&](auto f) {
+#pragma omp simd
+              for (auto k = std::size_t{0}; k < width; ++k)
+                out[k] = f(values[k]);
+            });
+            stack[top - 1] = {out, uniform};
+            break;
+          }
+
+          --top;
+          auto lhs = stack[top - 1];
+          auto rhs = stack[top];
+          auto uniform = lhs.uniform && rhs.uniform;
+          auto out = is_last && !uniform ? output.data() : slot(top - 1);
+          visit_binary(step.op, [&](auto f) {
+            if (uniform) {
+              out[0] = f(lhs.values[0], rhs.values[0]);
+            } else if (lhs.uniform) {
+              auto value = lhs.values[0];
+#pragma omp simd
+              for (auto k = std::size_t{0}; k < count; ++k)
+                out[k] = f(value, rhs.values[k]);
+            } else if (rhs.uniform) {
+              auto value = rhs.values[0];
+#pragma omp simd
+              for (auto k = std::size_t{0}; k < count; ++k)
+                out[k] = f(lhs.values[k], value);
+            } else {
+#pragma omp simd
+              for (auto k = std::size_t{0}; k < count; ++k)
+                out[k] = f(lhs.values[k], rhs.values[k]);
+            }
+          });
+          stack[top - 1] = {out, uniform};
+        }
+      }
+
+      auto [values, uniform] = stack[0];
+      if (uniform)
+        std::ranges::fill(output, values[0]);
+      else if (values != output.data())
+        std::copy_n(values, count, output.begin());
+    }
+  }
+
+private:
+  enum class opcode : std::uint8_t {
+    constant,
+    variable,
+    negate,
+    sin,
+    cos,
+    tan,
+    asin,
+    acos,
+    atan,
+    sinh,
+    cosh,
+    tanh,
+    exp,
+    log,
+    sqrt,
+    abs,
+    add,
+    subtract,
+    multiply,
+    divide,
+    power,
+    minimum,
+    maximum,
+  };
+
+  struct instruction {
+    opcode op;
+    std::size_t index = 0;
+    T value = 0;
+  };
+
+  static constexpr auto arity(opcode op) -> std::size_t {
+    if (op == opcode::constant || op == opcode::variable)
+      return 0;
+    return op < opcode::add ? 1 : 2;
+  }
+
+  // Calls `callable` with the function object of a unary or a binary `op`.
+  // The same objects fold constants, so folding doesn't change the result.
+  static void visit_unary(opcode op, auto callable) {
+    switch (op) {
+    case opcode::negate:
+      return callable([](T v) { return -v; });
+    case opcode::sin:
+      return callable([](T v) { return std::sin(v); });
+    case opcode::cos:
+      return callable([](T v) { return std::cos(v); });
+    case opcode::tan:
+      return callable([](T v) { return std::tan(v); });
+    case opcode::asin:
+      return callable([](T v) { return std::asin(v); });
+    case opcode::acos:
+      return callable([](T v) { return std::acos(v); });
+    case opcode::atan:
+      return callable([](T v) { return std::atan(v); });
+    case opcode::sinh:
+      return callable([](T v) { return std::sinh(v); });
+    case opcode::cosh:
+      return callable([](T v) { return std::cosh(v); });
+    case opcode::tanh:
+      return callable([](T v) { return std::tanh(v); });
+    case opcode::exp:
+      return callable([](T v) { return std::exp(v); });
+    case opcode::log:
+      return callable([](T v) { return std::log(v); });
+    case opcode::sqrt:
+      return callable([](T v) { return std::sqrt(v); });
+    case opcode::abs:
+      return callable([](T v) { return std::abs(v); });
+    default:
+      throw std::logic_error{"not a unary operation"};
+    }
+  }
+
+  static void visit_binary(opcode op, auto callable) {
+    switch (op) {
+    case opcode::add:
+      return callable([](T lhs, T rhs) { return lhs + rhs; });
+    case opcode::subtract:
+      return callable([](T lhs, T rhs) { return lhs - rhs; });
+    case opcode::multiply:
+      return callable([](T lhs, T rhs) { return lhs * rhs; });
+    case opcode::divide:
+      return callable([](T lhs, T rhs) { return lhs / rhs; });
+    case opcode::power:
+      return callable([](T lhs, T rhs) { return std::pow(lhs, rhs); });
+    case opcode::minimum:
+      return callable([](T lhs, T rhs) { return std::min(lhs, rhs); });
+    case opcode::maximum:
+      return callable([](T lhs, T rhs) { return std::max(lhs, rhs); });
+    default:
+      throw std::logic_error{"not a binary operation"};
+    }
+  }
+
+  expression(std::string text, std::vector<std::string> variable_names,
+             std::span<const instruction> instructions)
+      : source(std::move(text)), variables(std::move(variable_names)) {
+    for (auto &&step : instructions)
+      emit(step);
+  }
+
+  void check_arity(std::size_t num_arguments) const {
+    if (num_arguments != variables.size())
+      throw std::invalid_argument{
+          fmt::format("`{}` takes {} arguments, got {}", source,
+                      variables.size(), num_arguments)};
+  }
+
+  // Appends an instruction, folding operations on constants.
+  void emit(instruction next) {
+    auto num_operands = arity(next.op);
+    auto is_constant = [&](std::size_t from_end) {
+      return code.size() >= from_end &&
+             code[code.size() - from_end].op == opcode::constant;
+    };
+    if (num_operands == 1 && is_constant(1)) {
+      visit_unary(next.op,
+                  [&](auto f) { code.back().value = f(code.back().value); });
+      return;
+    }
+    if (num_operands == 2 && is_constant(1) && is_constant(2)) {
+      auto rhs = code.back().value;
+      code.pop_back();
+      --stack_size;
+      visit_binary(next.op, [&](auto f) {
+        code.back().value = f(code.back().value, rhs);
+      });
+      return;
+    }
+
+    code.push_back(next);
+    stack_size = stack_size + 1 - num_operands;
+    depth = std::max(depth, stack_size);
+    if (depth > max_depth)
+      throw std::invalid_argument{
+          fmt::format("`{}` is nested too deeply", source)};
+  }
+
+  // Recursive descent over
+  //   sum     = product {("+" | "-") product}
+  //   product = unary {("*" | "/") unary}
+  //   unary   = ("-" | "+") unary | power
+  //   power   = primary ["^" unary]
+  //   primary = number | name | name "(" sum {"," sum} ")" | "(" sum ")"
+  class expression_parser {
+  public:
+    expression_parser(expression &output, std::string_view input)
+        : result(output), text(input) {}
+
+    void parse() {
+      sum();
+      if (skip_spaces(); position != text.size())
+        fail("unexpected character");
+    }
+
+  private:
+    void sum() {
+      product();
+      while (true) {
+        if (consume('+')) {
+          product();
+          result.emit({.op = opcode::add});
+        } else if (consume('-')) {
+          product();
+          result.emit({.op = opcode::subtract});
+        } else {
+          return;
+        }
+      }
+    }
+
+    void product() {
+      unary();
+      while (true) {
+        if (consume('*')) {
+          unary();
+          result.emit({.op = opcode::multiply});
+        } else if (consume('/')) {
+          unary();
+          result.emit({.op = opcode::divide});
+        } else {
+          return;
+        }
+      }
+    }
+
+    void unary() {
+      if (consume('-')) {
+        unary();
+        result.emit({.op = opcode::negate});
+      } else if (consume('+')) {
+        unary();
+      } else {
+        power();
+      }
+    }
+
+    void power() {
+      primary();
+      if (consume('^')) {
+        unary();
+        result.emit({.op = opcode::power});
+      }
+    }
+
+    void primary() {
+      skip_spaces();
+      if (consume('(')) {
+        sum();
+        expect(')');
+        return;
+      }
+      if (position == text.size())
+        fail("unexpected end");
+
+      auto c = static_cast<unsigned char>(text[position]);
+      if (std::isdigit(c) || c == '.') {
+        number();
+        return;
+      }
+      if (!std::isalpha(c) && c != '_')
+        fail("unexpected character");
+
+      auto name_start = position;
+      while (position < text.size() &&
+             (std::isalnum(static_cast<unsigned char>(text[position])) ||
+              text[position] == '_'))
+        ++position;
+      auto name = text.substr(name_start, position - name_start);
+
+      if (consume('(')) {
+        call(name, name_start);
+        return;
+      }
+      if (auto found = std::ranges::find(result.variables, name);
+          found != result.variables.end()) {
+        auto index = found - result.variables.begin();
+        result.emit({.op = opcode::variable,
+                     .index = static_cast<std::size_t>(index)});
+        return;
+      }
+      if (name == "pi")
+        result.emit({.op = opcode::constant, .value = std::numbers::pi_v<T>});
+      else if (name == "e")
+        result.emit({.op = opcode::constant, .value = std::numbers::e_v<T>});
+      else
+        fail(fmt::format("unknown variable {}", name), name_start);
+    }
+
+    void number() {
+      auto value = T{};
+      auto [end, error] = std::from_chars(text.data() + position,
+                                          text.data() + text.size(), value);
+      if (error != std::errc{})
+        fail("malformed number");
+      position = static_cast<std::size_t>(end - text.data());
+      result.emit({.op = opcode::constant, .value = value});
+    }
+
+    void call(std::string_view name, std::size_t name_start) {
+      static constexpr auto functions =
+          std::array<std::pair<std::string_view, opcode>, 16>{{
+              {"sin", opcode::sin},
+              {"cos", opcode::cos},
+              {"tan", opcode::tan},
+              {"asin", opcode::asin},
+              {"acos", opcode::acos},
+              {"atan", opcode::atan},
+              {"sinh", opcode::sinh},
+              {"cosh", opcode::cosh},
+              {"tanh", opcode::tanh},
+              {"exp", opcode::exp},
+              {"log", opcode::log},
+              {"sqrt", opcode::sqrt},
+              {"abs", opcode::abs},
+              {"pow", opcode::power},
+              {"min", opcode::minimum},
+              {"max", opcode::maximum},
+          }};
+      auto found = std::ranges::find_if(
+          functions, [&](auto &&function) { return function.first == name; });
+      if (found == functions.end())
+        fail(fmt::format("unknown function {}", name), name_start);
+
+      sum();
+      for (auto i = std::size_t{1}; i < arity(found->second); ++i) {
+        expect(',');
+        sum();
+      }
+      expect(')');
+      result.emit({.op = found->second});
+    }
+
+    void skip_spaces() {
+      while (position < text.size() &&
+             std::isspace(static_cast<unsigned char>(text[position])))
+        ++position;
+    }
+
+    auto consume(char c) -> bool {
+      skip_spaces();
+      if (position == text.size() || text[position] != c)
+        return false;
+      ++position;
+      return true;
+    }
+
+    void expect(char c) {
+      if (!consume(c))
+        fail(fmt::format("expected `{}`", c));
+    }
+
+    [[noreturn]] void fail(std::string_view what) { fail(what, position); }
+
+    [[noreturn]] void fail(std::string_view what, std::size_t where) {
+      throw std::invalid_argument{
+          fmt::format("{} at position {} of `{}`", what, where, text)};
+    }
+
+    expression &result;
+    std::string_view text;
+    std::size_t position = 0;
+  };
+
+  std::string source;
+  std::vector<std::string> variables;
+  std::vector<instruction> code;
+  std::size_t stack_size = 0;
+  std::size_t depth = 0;
+};
+
+} // namespace transfer
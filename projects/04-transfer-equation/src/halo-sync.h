@@ -0,0 +1,52 @@
+// Copyright (c) 2024 Sergei Zimmerman
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+namespace transfer {
+
+enum class halo_side { prev, next };
+
+// Counts one more halo written or consumed. Every counter has a single
+// writer, the release store publishes the slot to whoever acquires the
+// count. `counter` is a `std::atomic` or a `std::atomic_ref`.
+void bump_counter(auto &&counter) {
+  counter.store(counter.load(std::memory_order_relaxed) + 1,
+                std::memory_order_release);
+}
+
+// Spins until `ready()` holds, running `poll()` between the checks. The
+// parties of the exchange may share a core, so the waiting one yields.
+void wait_until(auto ready, auto poll) {
+  while (!ready()) {
+    poll();
+    std::this_thread::yield();
+  }
+}
+
+void wait_until(auto ready) {
+  wait_until(ready, [] {});
+}
+
+} // namespace transfer
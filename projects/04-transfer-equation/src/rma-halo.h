@@ -0,0 +1,202 @@
+// Copyright (c) 2024 Sergei Zimmerman
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#pragma once
+
+#include "halo-sync.h"
+
+#include <boost/mpi.hpp>
+#include <mpi.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace transfer {
+
+// Halo exchange with one-sided MPI. Every process exposes a ring of
+// `ring_depth` incoming halos per neighbour in a window, and the neighbour
+// puts its halo into the next slot of the ring and then bumps the count of
+// written halos next to it. The receiver posts no receive and bumps the
+// sender's count of consumed halos once it is done with a slot, so the
+// sender runs up to `ring_depth` halos ahead before it waits.
+//
+// The window stays in a passive-target epoch of all processes for its whole
+// life. The counters are only updated with atomic accumulates and read with
+// fetch-and-op, the halos are flushed before their counter is bumped.
+//
+// The slots for the halos going to the previous process hold `leftward_size`
+// values on every process and those going to the next one
+// `rightward_size`, so every process knows where to put.
+template <typename T> class rma_halo {
+public:
+  static constexpr std::size_t ring_depth = 4;
+
+  // Collective over `world`.
+  rma_halo(const boost::mpi::communicator &world, std::size_t leftward_size,
+           std::size_t rightward_size)
+      : comm(world), rank(world.rank()), leftward(leftward_size),
+        rightward(rightward_size), to_prev(leftward_size),
+        to_next(rightward_size) {
+    auto size = rings_offset + ring_depth * (leftward + rightward) * sizeof(T);
+    auto base = static_cast<void *>(nullptr);
+    check(MPI_Win_allocate(static_cast<MPI_Aint>(size), 1, MPI_INFO_NULL,
+                           comm, &base, &window),
+          "MPI_Win_allocate");
+    own = static_cast<std::byte *>(base);
+    for (auto word : {written_from_prev, written_from_next, consumed_by_prev,
+                      consumed_by_next})
+      *reinterpret_cast<std::uint64_t *>(own + word * sizeof(std::uint64_t)) =
+          0;
+    comm.barrier();
+    check(MPI_Win_lock_all(0, window), "MPI_Win_lock_all");
+  }
+
+  rma_halo(const rma_halo &) = delete;
+  rma_halo &operator=(const rma_halo &) = delete;
+
+  // Collective over `world`.
+  ~rma_halo() {
+    MPI_Win_unlock_all(window);
+    MPI_Win_free(&window);
+  }
+
+  // The buffer the halo for the neighbour on `side` is packed into.
+  auto outgoing(halo_side side) -> std::span<T> {
+    return side == halo_side::prev ? std::span<T>{to_prev}
+                                   : std::span<T>{to_next};
+  }
+
+  // The slot of the ring holding the next halo from the neighbour on `side`,
+  // valid once `wait_readable` returns.
+  auto incoming(halo_side side) const -> std::span<const T> {
+    auto from_prev = side == halo_side::prev;
+    auto count = from_prev ? consumed_from_prev : consumed_from_next;
+    return {reinterpret_cast<const T *>(
+                own + ring_offset(from_prev, count % ring_depth)),
+            from_prev ? rightward : leftward};
+  }
+
+  // Waits until the neighbour has a free slot in its ring.
+  void wait_writable(halo_side side) {
+    auto written = side == halo_side::prev ? written_to_prev : written_to_next;
+    auto consumed = side == halo_side::prev ? consumed_by_prev
+                                            : consumed_by_next;
+    wait_until(
+        [&] { return written - fetch(rank, consumed) < ring_depth; });
+  }
+
+  // Puts the first `count` values of the outgoing buffer into the ring of
+  // the neighbour on `side`.
+  void publish(halo_side side, std::size_t count) {
+    auto to_prev_side = side == halo_side::prev;
+    auto target = to_prev_side ? rank - 1 : rank + 1;
+    auto &written = to_prev_side ? written_to_prev : written_to_next;
+    auto buffer = to_prev_side ? to_prev.data() : to_next.data();
+    auto offset = ring_offset(!to_prev_side, written % ring_depth);
+    check(MPI_Put(buffer, static_cast<int>(count), datatype(), target,
+                  static_cast<MPI_Aint>(offset), static_cast<int>(count),
+                  datatype(), window),
+          "MPI_Put");
+    check(MPI_Win_flush(target, window), "MPI_Win_flush");
+    ++written;
+    store(target, to_prev_side ? written_from_next : written_from_prev,
+          written);
+  }
+
+  // Waits until the neighbour has put the next halo.
+  void wait_readable(halo_side side) {
+    auto from_prev = side == halo_side::prev;
+    auto consumed = from_prev ? consumed_from_prev : consumed_from_next;
+    auto word = from_prev ? written_from_prev : written_from_next;
+    wait_until([&] { return fetch(rank, word) > consumed; });
+    check(MPI_Win_sync(window), "MPI_Win_sync");
+  }
+
+  void release(halo_side side) {
+    auto from_prev = side == halo_side::prev;
+    auto &consumed = from_prev ? consumed_from_prev : consumed_from_next;
+    ++consumed;
+    store(from_prev ? rank - 1 : rank + 1,
+          from_prev ? consumed_by_next : consumed_by_prev, consumed);
+  }
+
+private:
+  // Counters in the window of a process: halos written into its rings by
+  // the neighbours and its halos consumed by them.
+  static constexpr std::size_t written_from_prev = 0;
+  static constexpr std::size_t written_from_next = 1;
+  static constexpr std::size_t consumed_by_prev = 2;
+  static constexpr std::size_t consumed_by_next = 3;
+  static constexpr std::size_t rings_offset = 64;
+
+  static void check(int result, const char *routine) {
+    if (result != MPI_SUCCESS)
+      throw boost::mpi::exception(routine, result);
+  }
+
+  static auto datatype() -> MPI_Datatype {
+    return boost::mpi::get_mpi_datatype<T>();
+  }
+
+  // The ring from the previous process comes first.
+  auto ring_offset(bool from_prev, std::size_t slot) const -> std::size_t {
+    return rings_offset +
+           (from_prev ? slot * rightward
+                      : ring_depth * rightward + slot * leftward) *
+               sizeof(T);
+  }
+
+  auto fetch(int target, std::size_t word) -> std::uint64_t {
+    auto value = std::uint64_t{0};
+    check(MPI_Fetch_and_op(nullptr, &value, MPI_UINT64_T, target,
+                           static_cast<MPI_Aint>(word * sizeof(value)),
+                           MPI_NO_OP, window),
+          "MPI_Fetch_and_op");
+    check(MPI_Win_flush(target, window), "MPI_Win_flush");
+    return value;
+  }
+
+  void store(int target, std::size_t word, std::uint64_t value) {
+    check(MPI_Accumulate(&value, 1, MPI_UINT64_T, target,
+                         static_cast<MPI_Aint>(word * sizeof(value)), 1,
+                         MPI_UINT64_T, MPI_REPLACE, window),
+          "MPI_Accumulate");
+    check(MPI_Win_flush(target, window), "MPI_Win_flush");
+  }
+
+  boost::mpi::communicator comm;
+  int rank;
+  std::size_t leftward;
+  std::size_t rightward;
+  std::vector<T> to_prev;
+  std::vector<T> to_next;
+  MPI_Win window = MPI_WIN_NULL;
+  std::byte *own = nullptr;
+  // Halos this process has put and consumed.
+  std::uint64_t written_to_prev = 0;
+  std::uint64_t written_to_next = 0;
+  std::uint64_t consumed_from_prev = 0;
+  std::uint64_t consumed_from_next = 0;
+};
+
+} // namespace transfer
@@ -0,0 +1,209 @@
+// Copyright (c) 2024 Sergei Zimmerman
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#pragma once
+
+#include "halo-sync.h"
+
+#include <boost/mpi.hpp>
+#include <mpi.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace transfer {
+
+// Halo exchange between the neighbouring processes of a node through an MPI
+// shared-memory window. Every process packs its outgoing halo into its own
+// part of the window, one slot per neighbour, and a neighbour on the same
+// node unpacks it from there straight into its ghost columns.
+//
+// Every slot has a pair of counters: the writer publishes a new halo by
+// bumping its count of written halos, the reader bumps its count of
+// consumed ones once it is done with the slot, and the slot is only written
+// again after that. The counters sit on their own cache lines at the start
+// of the part of their owner, followed by the sizes of the slots.
+template <typename T> class shared_halo {
+public:
+  // Collective over `world`. The slots hold `to_prev_size` and
+  // `to_next_size` values.
+  shared_halo(const boost::mpi::communicator &world, std::size_t to_prev_size,
+              std::size_t to_next_size) {
+    auto node_comm = MPI_Comm{};
+    check(MPI_Comm_split_type(world, MPI_COMM_TYPE_SHARED, world.rank(),
+                              MPI_INFO_NULL, &node_comm),
+          "MPI_Comm_split_type");
+    node = boost::mpi::communicator{node_comm, boost::mpi::comm_take_ownership};
+
+    auto size = header_size + (to_prev_size + to_next_size) * sizeof(T);
+    auto base = static_cast<void *>(nullptr);
+    check(MPI_Win_allocate_shared(static_cast<MPI_Aint>(size),
+                                  static_cast<int>(sizeof(T)),
+                                  MPI_INFO_NULL, node, &base, &window),
+          "MPI_Win_allocate_shared");
+    check(MPI_Win_lock_all(MPI_MODE_NOCHECK, window), "MPI_Win_lock_all");
+    own = static_cast<std::byte *>(base);
+    for (auto word : {written_to_prev, written_to_next, consumed_from_prev,
+                      consumed_from_next})
+      *counter(own, word) = 0;
+    *counter(own, to_prev_slot_size) = to_prev_size;
+    *counter(own, to_next_slot_size) = to_next_size;
+    check(MPI_Win_sync(window), "MPI_Win_sync");
+    node.barrier();
+
+    prev = neighbour_part(world, world.rank() - 1);
+    next = neighbour_part(world, world.rank() + 1);
+  }
+
+  shared_halo(const shared_halo &) = delete;
+  shared_halo &operator=(const shared_halo &) = delete;
+
+  // Collective over the node.
+  ~shared_halo() {
+    MPI_Win_unlock_all(window);
+    MPI_Win_free(&window);
+  }
+
+  // Whether the neighbour is on the same node.
+  auto shares(halo_side side) const -> bool {
+    return (side == halo_side::prev ? prev : next) != nullptr;
+  }
+
+  // The slot for the neighbour on `side`, valid once `wait_writable` returns.
+  auto outgoing(halo_side side) const -> std::span<T> {
+    return slot(own, side == halo_side::prev);
+  }
+
+  // The slot of the neighbour on `side` meant for this process, valid once
+  // `wait_readable` returns.
+  auto incoming(halo_side side) const -> std::span<const T> {
+    return side == halo_side::prev ? slot(prev, false) : slot(next, true);
+  }
+
+  // Waits until the neighbour has consumed the previous halo.
+  void wait_writable(halo_side side) {
+    auto written = load(own, written_word(side));
+    auto reader = side == halo_side::prev ? prev : next;
+    auto consumed = side == halo_side::prev ? consumed_from_next
+                                            : consumed_from_prev;
+    wait_until([&] { return load(reader, consumed) >= written; }, sync());
+  }
+
+  // The halo is already in place, whatever its size.
+  void publish(halo_side side, std::size_t) { bump(written_word(side)); }
+
+  // Waits until the neighbour has published the next halo.
+  void wait_readable(halo_side side) {
+    auto consumed = load(own, consumed_word(side));
+    auto writer = side == halo_side::prev ? prev : next;
+    auto written = side == halo_side::prev ? written_to_next : written_to_prev;
+    wait_until([&] { return load(writer, written) > consumed; }, sync());
+  }
+
+  void release(halo_side side) { bump(consumed_word(side)); }
+
+private:
+  static constexpr std::size_t written_to_prev = 0;
+  static constexpr std::size_t written_to_next = 1;
+  static constexpr std::size_t consumed_from_prev = 2;
+  static constexpr std::size_t consumed_from_next = 3;
+  static constexpr std::size_t to_prev_slot_size = 4;
+  static constexpr std::size_t to_next_slot_size = 5;
+  static constexpr std::size_t cache_line = 64;
+  static constexpr std::size_t header_size = 6 * cache_line;
+
+  static void check(int result, const char *routine) {
+    if (result != MPI_SUCCESS)
+      throw boost::mpi::exception(routine, result);
+  }
+
+  static auto written_word(halo_side side) -> std::size_t {
+    return side == halo_side::prev ? written_to_prev : written_to_next;
+  }
+
+  static auto consumed_word(halo_side side) -> std::size_t {
+    return side == halo_side::prev ? consumed_from_prev : consumed_from_next;
+  }
+
+  static auto counter(std::byte *part, std::size_t word) -> std::uint64_t * {
+    return reinterpret_cast<std::uint64_t *>(part + word * cache_line);
+  }
+
+  static auto slot(std::byte *part, bool to_prev) -> std::span<T> {
+    auto to_prev_size = *counter(part, to_prev_slot_size);
+    auto to_next_size = *counter(part, to_next_slot_size);
+    auto values = reinterpret_cast<T *>(part + header_size);
+    return to_prev ? std::span<T>{values, to_prev_size}
+                   : std::span<T>{values + to_prev_size, to_next_size};
+  }
+
+  static auto load(std::byte *part, std::size_t word) -> std::uint64_t {
+    return std::atomic_ref{*counter(part, word)}.load(
+        std::memory_order_acquire);
+  }
+
+  void bump(std::size_t word) {
+    check(MPI_Win_sync(window), "MPI_Win_sync");
+    bump_counter(std::atomic_ref{*counter(own, word)});
+  }
+
+  // Makes the stores of the other processes of the node visible.
+  auto sync() const {
+    return [this] { check(MPI_Win_sync(window), "MPI_Win_sync"); };
+  }
+
+  // The part of the window of the process `rank` of `world` if it is on the
+  // same node.
+  auto neighbour_part(const boost::mpi::communicator &world, int rank)
+      -> std::byte * {
+    if (rank < 0 || rank >= world.size())
+      return nullptr;
+    auto node_rank = MPI_UNDEFINED;
+    auto world_group = MPI_Group{};
+    auto node_group = MPI_Group{};
+    check(MPI_Comm_group(world, &world_group), "MPI_Comm_group");
+    check(MPI_Comm_group(node, &node_group), "MPI_Comm_group");
+    check(MPI_Group_translate_ranks(world_group, 1, &rank, node_group,
+                                    &node_rank),
+          "MPI_Group_translate_ranks");
+    MPI_Group_free(&world_group);
+    MPI_Group_free(&node_group);
+    if (node_rank == MPI_UNDEFINED)
+      return nullptr;
+
+    auto size = MPI_Aint{};
+    auto unit = 0;
+    auto base = static_cast<void *>(nullptr);
+    check(MPI_Win_shared_query(window, node_rank, &size, &unit, &base),
+          "MPI_Win_shared_query");
+    return static_cast<std::byte *>(base);
+  }
+
+  boost::mpi::communicator node;
+  MPI_Win window = MPI_WIN_NULL;
+  std::byte *own = nullptr;
+  std::byte *prev = nullptr;
+  std::byte *next = nullptr;
+};
+
+} // namespace transfer
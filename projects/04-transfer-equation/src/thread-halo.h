@@ -0,0 +1,188 @@
+// Copyright (c) 2024 Sergei Zimmerman
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#pragma once
+
+#include "halo-sync.h"
+
+#include <atomic>
+#include <barrier>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace transfer {
+
+// Worker threads of one process that split the x axis among themselves like
+// the processes of an MPI run do.
+class thread_group {
+public:
+  explicit thread_group(std::size_t num_workers)
+      : sync(static_cast<std::ptrdiff_t>(num_workers)), parts(num_workers) {}
+
+  thread_group(const thread_group &) = delete;
+  thread_group &operator=(const thread_group &) = delete;
+
+private:
+  friend class thread_world;
+
+  std::barrier<> sync;
+  // The halo of every worker, set while the halos are being created.
+  std::vector<void *> parts;
+};
+
+// A worker of a `thread_group`, which stands in for the communicator of the
+// solver: the workers are ranked along the x axis.
+class thread_world {
+public:
+  thread_world(thread_group &workers, int index)
+      : group(&workers), own_rank(index) {}
+
+  auto rank() const -> int { return own_rank; }
+  auto size() const -> int { return static_cast<int>(group->parts.size()); }
+
+  void barrier() const { group->sync.arrive_and_wait(); }
+
+  // Collective. Hands `part` to the other workers and returns the parts of
+  // the previous and the next worker, null if there is none. The first
+  // barrier keeps a worker from replacing its part while the others may
+  // still read those of the previous exchange.
+  auto exchange_parts(void *part) const -> std::pair<void *, void *> {
+    barrier();
+    group->parts[static_cast<std::size_t>(own_rank)] = part;
+    barrier();
+    auto part_of = [&](int index) -> void * {
+      if (index < 0 || index >= size())
+        return nullptr;
+      return group->parts[static_cast<std::size_t>(index)];
+    };
+    return {part_of(own_rank - 1), part_of(own_rank + 1)};
+  }
+
+private:
+  thread_group *group;
+  int own_rank;
+};
+
+// Halo exchange between the workers of a `thread_group`, the counterpart of
+// `shared_halo` without MPI. Every worker packs its outgoing halo into its
+// own slots, one per neighbour, and the neighbour unpacks it from there
+// straight into its ghost columns.
+//
+// Every slot has a pair of counters: the writer publishes a new halo by
+// bumping its count of written halos, the reader bumps its count of
+// consumed ones once it is done with the slot, and the slot is only written
+// again after that. Every counter has a single writer and sits on a cache
+// line of its own.
+template <typename T> class thread_halo {
+public:
+  // Collective over `world`. The slots hold `to_prev_size` and
+  // `to_next_size` values.
+  thread_halo(const thread_world &world, std::size_t to_prev_size,
+              std::size_t to_next_size)
+      : workers(world) {
+    own.to_prev.resize(to_prev_size);
+    own.to_next.resize(to_next_size);
+    auto [prev_part, next_part] = world.exchange_parts(&own);
+    prev = static_cast<part *>(prev_part);
+    next = static_cast<part *>(next_part);
+  }
+
+  thread_halo(const thread_halo &) = delete;
+  thread_halo &operator=(const thread_halo &) = delete;
+
+  // Collective, the neighbours may still be reading the slots.
+  ~thread_halo() { workers.barrier(); }
+
+  // Whether there is a neighbour on `side`.
+  auto shares(halo_side side) const -> bool {
+    return (side == halo_side::prev ? prev : next) != nullptr;
+  }
+
+  // The slot for the neighbour on `side`, valid once `wait_writable` returns.
+  auto outgoing(halo_side side) -> std::span<T> {
+    return side == halo_side::prev ? std::span<T>{own.to_prev}
+                                   : std::span<T>{own.to_next};
+  }
+
+  // The slot of the neighbour on `side` meant for this worker, valid once
+  // `wait_readable` returns.
+  auto incoming(halo_side side) const -> std::span<const T> {
+    return side == halo_side::prev ? std::span<const T>{prev->to_next}
+                                   : std::span<const T>{next->to_prev};
+  }
+
+  // Waits until the neighbour has consumed the previous halo.
+  void wait_writable(halo_side side) {
+    auto written = own.written(side).load(std::memory_order_relaxed);
+    auto &consumed = side == halo_side::prev ? prev->consumed(halo_side::next)
+                                             : next->consumed(halo_side::prev);
+    wait_until(
+        [&] { return consumed.load(std::memory_order_acquire) >= written; });
+  }
+
+  // The halo is already in place, whatever its size.
+  void publish(halo_side side, std::size_t) {
+    bump_counter(own.written(side));
+  }
+
+  // Waits until the neighbour has published the next halo.
+  void wait_readable(halo_side side) {
+    auto consumed = own.consumed(side).load(std::memory_order_relaxed);
+    auto &written = side == halo_side::prev ? prev->written(halo_side::next)
+                                            : next->written(halo_side::prev);
+    wait_until(
+        [&] { return written.load(std::memory_order_acquire) > consumed; });
+  }
+
+  void release(halo_side side) { bump_counter(own.consumed(side)); }
+
+private:
+  static constexpr std::size_t cache_line = 64;
+
+  using counter = std::atomic<std::uint64_t>;
+
+  struct part {
+    alignas(cache_line) counter written_to_prev{0};
+    alignas(cache_line) counter written_to_next{0};
+    alignas(cache_line) counter consumed_from_prev{0};
+    alignas(cache_line) counter consumed_from_next{0};
+    alignas(cache_line) std::vector<T> to_prev;
+    std::vector<T> to_next;
+
+    auto written(halo_side side) -> counter & {
+      return side == halo_side::prev ? written_to_prev : written_to_next;
+    }
+
+    auto consumed(halo_side side) -> counter & {
+      return side == halo_side::prev ? consumed_from_prev : consumed_from_next;
+    }
+  };
+
+  thread_world workers;
+  part own;
+  part *prev = nullptr;
+  part *next = nullptr;
+};
+
+} // namespace transfer
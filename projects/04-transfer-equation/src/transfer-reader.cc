@@ -0,0 +1,125 @@
+// Copyright (c) 2024 Sergei Zimmerman
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+
+#include "binary-output.h"
+
+#include <boost/program_options.hpp>
+#include <fmt/core.h>
+#include <fmt/ranges.h>
+#include <range/v3/all.hpp>
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace po = boost::program_options;
+
+namespace {
+
+// Rows of an adaptive time axis start with their time, like the output of
+// the solver.
+template <typename T>
+void print_grid(std::istream &is, const transfer::output_header &header) {
+  auto times = std::vector<double>{};
+  if (header.tau == 0) {
+    auto grid_start = is.tellg();
+    times.resize(header.t_dim);
+    is.seekg(static_cast<std::streamoff>(header.t_dim * header.x_dim *
+                                         sizeof(T)),
+             std::ios::cur);
+    is.read(reinterpret_cast<char *>(times.data()),
+            static_cast<std::streamsize>(times.size() * sizeof(double)));
+    if (!is)
+      throw std::runtime_error{"unexpected end of file"};
+    is.seekg(grid_start);
+  }
+
+  auto row = std::vector<T>(header.x_dim);
+  for (auto i : ranges::views::iota(std::uint64_t{0}, header.t_dim)) {
+    is.read(reinterpret_cast<char *>(row.data()),
+            static_cast<std::streamsize>(row.size() * sizeof(T)));
+    if (!is)
+      throw std::runtime_error{"unexpected end of file"};
+    if (times.empty())
+      fmt::println("{}", fmt::join(row, ", "));
+    else
+      fmt::println("{}, {}", times[i], fmt::join(row, ", "));
+  }
+}
+
+} // namespace
+
+auto main(int argc, char **argv) -> int {
+  auto desc = po::options_description{"allowed options"};
+  desc.add_options()("help", "produce this help message")(
+      "input", po::value<std::string>(), "binary output of transfer-solver")(
+      "header", "print the header instead of the grid");
+
+  auto positional = po::positional_options_description{};
+  positional.add("input", 1);
+
+  auto vm = po::variables_map{};
+  po::store(po::command_line_parser(argc, argv)
+                .options(desc)
+                .positional(positional)
+                .run(),
+            vm);
+  po::notify(vm);
+
+  if (vm.count("help") || !vm.count("input")) {
+    std::cout << desc << "\n";
+    return EXIT_FAILURE;
+  }
+
+  auto path = vm.at("input").as<std::string>();
+  auto is = std::ifstream{path, std::ios::binary};
+  if (!is)
+    throw std::runtime_error{fmt::format("can't open {}", path)};
+
+  auto header = transfer::output_header{};
+  is.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!is || header.magic != transfer::output_header::expected_magic)
+    throw std::runtime_error{fmt::format("{} is not a solver output", path)};
+
+  if (vm.count("header")) {
+    fmt::println("t_dim: {}, x_dim: {}, a: {}, b: {}, tau: {}, h: {}",
+                 header.t_dim, header.x_dim, header.a, header.b, header.tau,
+                 header.h);
+    return EXIT_SUCCESS;
+  }
+
+  switch (header.element_size) {
+  case sizeof(float):
+    print_grid<float>(is, header);
+    break;
+  case sizeof(double):
+    print_grid<double>(is, header);
+    break;
+  default:
+    throw std::runtime_error{
+        fmt::format("unsupported element size: {}", header.element_size)};
+  }
+
+  return EXIT_SUCCESS;
+}
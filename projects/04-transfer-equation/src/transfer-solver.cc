@@ -19,20 +19,55 @@
 // SOFTWARE.
 //
 
+#include "binary-output.h"
+#include "checkpoint.h"
+#include "decomposition.h"
+#include "expression.h"
+#include "rma-halo.h"
+#include "shared-halo.h"
+#include "thread-halo.h"
+
 #include <boost/format.hpp>
 #include <boost/mpi.hpp>
+#include <boost/mpi/cartesian_communicator.hpp>
 #include <boost/program_options.hpp>
 #include <boost/serialization/vector.hpp>
 #include <fmt/core.h>
 #include <fmt/ranges.h>
 #include <range/v3/all.hpp>
 
+#include <algorithm>
+#include <array>
+#include <barrier>
+#include <bit>
+#include <cassert>
 #include <chrono>
 #include <cmath>
 #include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <mdspan>
+#include <memory>
 #include <numbers>
+#include <optional>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #if 0
 #define DEBUG_PRINTS
@@ -73,149 +108,2703 @@ template <typename T> auto linspace(T a, T b, std::size_t n) -> std::vector<T> {
   return x;
 }
 
-template <std::floating_point T>
-auto solve_transfer_equation_impl(const mpi::communicator &world, auto data,
-                                  auto rhs, std::span<T> boundary_value,
-                                  std::span<T> xs, std::span<T> ts, T t_step,
-                                  T x_step) {
-  auto x_dim = get_num_x_points(data);
+// (t, x) grid. The default row-major layout keeps every time level
+// contiguous, so that the sweep over x is a unit-stride stream.
+template <typename T, typename Layout = std::layout_right>
+using grid_mdspan = std::mdspan<T, std::dextents<std::size_t, 2>, Layout>;
+
+// View of the time level `i` of a (t, x) grid.
+auto time_slice(auto mdspan, std::size_t i) {
+  using element_type = typename decltype(mdspan)::element_type;
+  using layout_type = typename decltype(mdspan)::layout_type;
+  if constexpr (std::is_same_v<layout_type, std::layout_right>) {
+    return std::span<element_type>{
+        mdspan.data_handle() + i * mdspan.stride(0), get_num_x_points(mdspan)};
+  } else {
+    using extents_type = std::dextents<std::size_t, 1>;
+    auto mapping = std::layout_stride::mapping<extents_type>{
+        extents_type{get_num_x_points(mdspan)}, std::array{mdspan.stride(1)}};
+    return std::mdspan<element_type, extents_type, std::layout_stride>{
+        mdspan.data_handle() + i * mdspan.stride(0), mapping};
+  }
+}
+
+// Levels of a grid with `t_dim` levels that go into the output: every
+// `every`-th one and the last, or none when nothing is going to be collected.
+auto select_output_levels(std::size_t t_dim, std::size_t every,
+                          bool dont_collect) -> std::vector<std::size_t> {
+  if (dont_collect)
+    return {};
+  auto levels = std::vector<std::size_t>{};
+  if (every != 0) {
+    for (auto i = std::size_t{0}; i < t_dim; i += every)
+      levels.push_back(i);
+  }
+  if (levels.empty() || levels.back() != t_dim - 1)
+    levels.push_back(t_dim - 1);
+  return levels;
+}
+
+// Local columns of the output: `count` columns from `first` on, `stride`
+// columns apart.
+struct output_columns {
+  std::size_t first;
+  std::size_t count;
+  std::size_t stride;
+};
+
+// The owned columns [first, first + count), which are the global x points
+// from `global_first` on, that are one of every `stride` global points.
+auto sample_columns(std::size_t first, std::size_t count,
+                    std::size_t global_first, std::size_t stride)
+    -> output_columns {
+  auto skip = (stride - global_first % stride) % stride;
+  if (skip >= count)
+    return {first, 0, stride};
+  return {first + skip, (count - skip - 1) / stride + 1, stride};
+}
+
+// Copies the sampled columns of the levels `levels` of the grid into a buffer
+// of the same layout.
+template <typename T, typename Layout>
+auto copy_samples(grid_mdspan<const T, Layout> grid,
+                  std::span<const std::size_t> levels, output_columns columns)
+    -> std::vector<T> {
+  auto result = std::vector<T>(levels.size() * columns.count);
+  auto copy = grid_mdspan<T, Layout>(result.data(), levels.size(),
+                                     columns.count);
+  for (auto k : ranges::views::iota(std::size_t{0}, levels.size()))
+    for (auto j : ranges::views::iota(std::size_t{0}, columns.count))
+      copy[k, j] = grid[levels[k], columns.first + j * columns.stride];
+  return result;
+}
+
+enum class grid_storage { full, rolling };
+
+auto parse_grid_storage(std::string_view name) -> grid_storage {
+  if (name == "full")
+    return grid_storage::full;
+  if (name == "rolling")
+    return grid_storage::rolling;
+  throw std::invalid_argument{fmt::format("unknown storage mode: {}", name)};
+}
 
-  constexpr auto tag = 0;
-  for (auto i :
-       ranges::views::iota(std::size_t{0}, get_num_time_points(data) - 1)) {
-    auto send_data_to_next = !(world.rank() == world.size() - 1);
+// Keeps every time level of the local grid. The output is sampled from it
+// once the grid is complete.
+template <typename T, typename Layout> class full_storage {
+public:
+  using value_type = T;
 
-    if (send_data_to_next) {
-      assert(world.rank() + 1 < world.size());
-      world.send(world.rank() + 1, tag, data[i, x_dim - 1]);
+  full_storage(std::size_t t_dim, std::size_t x_dim,
+               std::vector<std::size_t> output_levels, output_columns columns)
+      : data(t_dim * x_dim), grid(data.data(), t_dim, x_dim),
+        levels(std::move(output_levels)), sampled(columns) {}
+
+  auto level(std::size_t i) { return time_slice(grid, i); }
+  void commit(std::size_t) {}
+  void commit(std::size_t, std::size_t, std::size_t) {}
+
+  auto num_output_levels() const { return levels.size(); }
+
+  auto collect() const -> std::vector<T> {
+    return copy_samples<T, Layout>(grid, levels, sampled);
+  }
+
+  // Raw state for checkpoints of the level `i`: the levels [0, i], the later
+  // ones haven't been computed yet.
+  auto state_size(std::size_t i) const {
+    return (i + 1) * grid.extent(1) * sizeof(T);
+  }
+  void save(std::size_t i, std::span<std::byte> state) const {
+    if constexpr (std::is_same_v<Layout, std::layout_right>) {
+      std::memcpy(state.data(), data.data(), state_size(i));
+    } else {
+      auto *out = state.data();
+      for (auto k : ranges::views::iota(std::size_t{0}, i + 1))
+        for (auto j : ranges::views::iota(std::size_t{0}, grid.extent(1))) {
+          std::memcpy(out, &grid[k, j], sizeof(T));
+          out += sizeof(T);
+        }
+    }
+  }
+  void restore(std::size_t i, std::span<const std::byte> state) {
+    if constexpr (std::is_same_v<Layout, std::layout_right>) {
+      std::memcpy(data.data(), state.data(), state_size(i));
+    } else {
+      const auto *in = state.data();
+      for (auto k : ranges::views::iota(std::size_t{0}, i + 1))
+        for (auto j : ranges::views::iota(std::size_t{0}, grid.extent(1))) {
+          std::memcpy(&grid[k, j], in, sizeof(T));
+          in += sizeof(T);
+        }
     }
+  }
 
-    for (auto j : ranges::views::iota(std::size_t{0}, x_dim)) {
-      auto receive = [&]() {
-        assert(world.rank() >= 1);
-        auto result = T{};
-        world.recv(world.rank() - 1, tag, result);
+private:
+  std::vector<T> data;
+  grid_mdspan<T, Layout> grid;
+  std::vector<std::size_t> levels;
+  output_columns sampled;
+};
+
+// Keeps only the last `num_levels` time levels of the local grid. The sampled
+// columns of the output levels are copied out as soon as a level is done, so
+// only the output is kept besides the ring of levels.
+template <typename T, typename Layout> class rolling_storage {
+public:
+  using value_type = T;
+
+  rolling_storage(std::size_t x_dim, std::size_t num_levels,
+                  std::vector<std::size_t> output_levels,
+                  output_columns columns)
+      : rows(num_levels * x_dim), num_rows(num_levels), row_size(x_dim),
+        sampled(columns), snapshot_levels(std::move(output_levels)),
+        snapshots(snapshot_levels.size() * columns.count),
+        grid(snapshots.data(), snapshot_levels.size(), columns.count) {}
+
+  auto level(std::size_t i) {
+    return std::span<T>{rows}.subspan((i % num_rows) * row_size, row_size);
+  }
+
+  void commit(std::size_t i) { commit(i, 0, row_size); }
+
+  // Copies the sampled columns in [first, last) of the level `i` if it is an
+  // output level. The space-time tiles complete a level piece by piece.
+  void commit(std::size_t i, std::size_t first, std::size_t last) {
+    auto snapshot = std::ranges::lower_bound(snapshot_levels, i);
+    if (snapshot == snapshot_levels.end() || *snapshot != i)
+      return;
+    auto k = static_cast<std::size_t>(snapshot - snapshot_levels.begin());
+    auto row = level(i);
+    auto sample_at_or_after = [&](std::size_t column) {
+      if (column <= sampled.first)
+        return std::size_t{0};
+      return std::min((column - sampled.first + sampled.stride - 1) /
+                          sampled.stride,
+                      sampled.count);
+    };
+    for (auto j : ranges::views::iota(sample_at_or_after(first),
+                                      sample_at_or_after(last)))
+      grid[k, j] = row[sampled.first + j * sampled.stride];
+  }
+
+  auto num_output_levels() const { return snapshot_levels.size(); }
+
+  auto collect() const -> std::vector<T> { return snapshots; }
+
+  // Raw state for checkpoints: the ring of levels and the snapshots so far.
+  auto state_size(std::size_t) const {
+    return (rows.size() + snapshots.size()) * sizeof(T);
+  }
+  void save(std::size_t, std::span<std::byte> state) const {
+    auto rows_size = rows.size() * sizeof(T);
+    std::memcpy(state.data(), rows.data(), rows_size);
+    std::memcpy(state.data() + rows_size, snapshots.data(),
+                snapshots.size() * sizeof(T));
+  }
+  void restore(std::size_t, std::span<const std::byte> state) {
+    auto rows_size = rows.size() * sizeof(T);
+    std::memcpy(rows.data(), state.data(), rows_size);
+    std::memcpy(snapshots.data(), state.data() + rows_size,
+                snapshots.size() * sizeof(T));
+  }
+
+private:
+  std::vector<T> rows;
+  std::size_t num_rows;
+  std::size_t row_size;
+  output_columns sampled;
+  std::vector<std::size_t> snapshot_levels;
+  std::vector<T> snapshots;
+  grid_mdspan<T, Layout> grid;
+};
+
+// Local x and global t axes of the grid. An adaptive time axis has no
+// uniform step, its `t_step` is 0.
+template <std::floating_point T> struct grid_axes {
+  std::span<const T> xs;
+  std::span<const T> ts;
+  T t_step;
+  T x_step;
+
+  // The axes the kernels see for the step from the level `i`.
+  auto at_step(std::size_t i) const -> grid_axes {
+    return {xs, ts, t_step != 0 ? t_step : ts[i + 1] - ts[i], x_step};
+  }
+};
+
+// Runs `update(j)` for every j in [first, last). The updates must be
+// independent of each other, so the loop is explicitly vectorized.
+void simd_for(std::size_t first, std::size_t last, auto update) {
+#pragma omp simd
+  for (auto j = first; j < last; ++j)
+    update(j);
+}
+
+// Functions that evaluate many points at once, like compiled expressions.
+template <typename F, typename T>
+concept batch_function =
+    requires(const F &f, std::span<const transfer::batch_argument<T>> arguments,
+             std::span<T> result) { f.evaluate(arguments, result); };
+
+// Sources that know the values of whole rows of their own x axis.
+template <typename F, typename T>
+concept row_source = requires(const F &f, T offset, T t, std::size_t first,
+                              std::size_t last) {
+  { f.row(offset, t, first, last) } -> std::same_as<const T *>;
+};
+
+// The rhs f(x, t) of an ensemble member compiled from an expression. The
+// largest subexpressions that don't depend on t are tabulated over the local
+// x axis up front, once for every offset the kernels sample it at, and only
+// the rest is evaluated every step. A time-invariant rhs is a table, a
+// separable one like sin(2 * pi * x) * exp(-t) costs a multiplication per
+// point. The values are the same as those of the whole expression.
+template <std::floating_point T> class cached_source {
+public:
+  cached_source(const transfer::expression<T> &rhs, std::span<const T> axis,
+                std::span<const T> offsets)
+      : cached_source(rhs.split(std::uint64_t{1} << x_variable), axis,
+                      offsets) {}
+
+  // Values f(xs[j] - offset, t) for j in [first, last), indexed from
+  // `first`. They stay valid until the next call from the same thread.
+  auto row(T offset, T t, std::size_t first, std::size_t last) const
+      -> const T * {
+    auto count = last > first ? last - first : std::size_t{0};
+    auto columns = columns_at(offset, first, count);
+    if (auto variable = rest.as_variable(); variable && *variable != t_variable)
+      return columns[column_of(*variable)].data();
+
+    thread_local auto arguments = std::vector<transfer::batch_argument<T>>{};
+    thread_local auto values = std::vector<T>{};
+    arguments.clear();
+    for (auto variable : ranges::views::iota(std::size_t{0}, parts.size() + 2))
+      arguments.push_back(
+          variable == t_variable
+              ? transfer::batch_argument<T>::uniform(t)
+              : transfer::batch_argument<T>::varying(
+                    columns[column_of(variable)]));
+    values.resize(count);
+    rest.evaluate(arguments, values);
+    return values.data();
+  }
+
+private:
+  static constexpr std::size_t x_variable = 0;
+  static constexpr std::size_t t_variable = 1;
+
+  cached_source(std::pair<std::vector<transfer::expression<T>>,
+                          transfer::expression<T>>
+                    split,
+                std::span<const T> axis, std::span<const T> offsets)
+      : parts(std::move(split.first)), rest(std::move(split.second)),
+        xs(axis) {
+    for (auto offset : offsets) {
+      auto &table = tables.emplace_back(
+          offset_table{.offset = offset, .columns = {}});
+      tabulate(offset, xs, table.columns);
+    }
+  }
+
+  // The shifted x axis comes first, then the parts.
+  static auto column_of(std::size_t variable) -> std::size_t {
+    return variable == x_variable ? 0 : variable - 1;
+  }
+
+  struct offset_table {
+    T offset;
+    std::vector<std::vector<T>> columns;
+  };
+
+  // The columns [first, first + count) at the offset. The tables are only
+  // read once built, so no lock is needed. Offsets that weren't given up
+  // front, like half of an adaptive step, are evaluated for just these
+  // columns into a slot of the calling thread that the next call overwrites.
+  auto columns_at(T offset, std::size_t first, std::size_t count) const
+      -> std::span<const std::span<const T>> {
+    thread_local auto views = std::vector<std::span<const T>>{};
+    thread_local auto slot = std::vector<std::vector<T>>{};
+    auto table = std::ranges::find(tables, offset, &offset_table::offset);
+    auto &columns = table != tables.end() ? table->columns : slot;
+    if (table == tables.end())
+      tabulate(offset, xs.subspan(first, count), slot);
+    auto from = table != tables.end() ? first : std::size_t{0};
+    views.clear();
+    for (auto &&column : columns)
+      views.push_back(std::span<const T>{column}.subspan(from, count));
+    return views;
+  }
+
+  // The shifted `axis` and the parts over it.
+  void tabulate(T offset, std::span<const T> axis,
+                std::vector<std::vector<T>> &columns) const {
+    columns.resize(parts.size() + 1);
+    auto &points = columns.front();
+    points.resize(axis.size());
+    for (auto j : ranges::views::iota(std::size_t{0}, axis.size()))
+      points[j] = axis[j] - offset;
+    auto no_time = T{0};
+    auto arguments =
+        std::array{transfer::batch_argument<T>::varying(points),
+                   transfer::batch_argument<T>::uniform(no_time)};
+    for (auto k : ranges::views::iota(std::size_t{0}, parts.size())) {
+      columns[k + 1].resize(axis.size());
+      parts[k].evaluate(std::span<const transfer::batch_argument<T>>{arguments},
+                        std::span<T>{columns[k + 1]});
+    }
+  }
+
+  std::vector<transfer::expression<T>> parts;
+  transfer::expression<T> rest;
+  std::span<const T> xs;
+  std::vector<offset_table> tables;
+};
+
+// The rhs as the kernels of a member sample it. Compiled expressions are
+// tabulated at `offsets`.
+template <std::floating_point T, typename Rhs>
+auto make_source(const Rhs &rhs, std::span<const T> xs,
+                 std::span<const T> offsets) {
+  if constexpr (std::same_as<Rhs, transfer::expression<T>>)
+    return cached_source<T>{rhs, xs, offsets};
+  else
+    return std::cref(rhs);
+}
+
+// The source f(xs[j] - offset, t) of the columns [first, last) as a function
+// of j. Row sources and batch functions are evaluated for the whole row into
+// a buffer of the calling thread that lives until its next call, other
+// functions are inlined into the kernel.
+template <std::floating_point T, typename Rhs>
+auto source_row(const Rhs &rhs, std::span<const T> xs, T offset, T t,
+                std::size_t first, std::size_t last) {
+  if constexpr (row_source<Rhs, T>) {
+    return [data = rhs.row(offset, t, first, last), first](std::size_t j) {
+      return data[j - first];
+    };
+  } else if constexpr (batch_function<Rhs, T>) {
+    thread_local auto points = std::vector<T>{};
+    thread_local auto values = std::vector<T>{};
+    auto count = last > first ? last - first : std::size_t{0};
+    auto row = xs.subspan(std::min(first, xs.size()), count);
+    if (offset != 0) {
+      points.resize(count);
+      auto shifted = points.data();
+      simd_for(0, count, [&](std::size_t j) { shifted[j] = row[j] - offset; });
+      row = points;
+    }
+    values.resize(count);
+    auto arguments = std::array{transfer::batch_argument<T>::varying(row),
+                                transfer::batch_argument<T>::uniform(t)};
+    rhs.evaluate(std::span<const transfer::batch_argument<T>>{arguments},
+                 std::span<T>{values});
+    return [data = values.data(), first](std::size_t j) {
+      return data[j - first];
+    };
+  } else {
+    return [&rhs, xs, offset, t](std::size_t j) {
+      return rhs(xs[j] - offset, t);
+    };
+  }
+}
+
+// Finite difference schemes for u_t + u_x = f. Every scheme declares at
+// compile time how far its stencil reaches to the left and to the right, how
+// many known time levels it reads and whether it sweeps the new level from
+// left to right (reading the new value of its left neighbour). The halo
+// widths, the number of stored levels and the exchange pattern are derived
+// from that. `advance` computes the columns [first, last) of level i + 1.
+// The stored values are read as T, the type of the axes, so the arithmetic
+// is done in T even when the storage keeps narrower values.
+
+// First-order explicit upwind ("left corner") scheme.
+struct left_corner {
+  static constexpr std::size_t left_width = 1;
+  static constexpr std::size_t right_width = 0;
+  static constexpr std::size_t time_depth = 1;
+  static constexpr bool sweeps = false;
+
+  template <std::floating_point T>
+  static void advance(auto &storage, const grid_axes<T> &axes,
+                      const auto &rhs, std::size_t i, std::size_t first,
+                      std::size_t last) {
+    auto prev = storage.level(i);
+    auto next = storage.level(i + 1);
+    auto [xs, ts, t_step, x_step] = axes;
+    auto source = source_row(rhs, xs, T{0}, ts[i], first, last);
+    simd_for(first, last, [&](std::size_t j) {
+      auto neg = T{prev[j - 1]};
+      auto pos = T{prev[j]};
+      next[j] = pos + source(j) * t_step - (pos - neg) * t_step / x_step;
+    });
+  }
+};
+
+// Second-order explicit Lax-Wendroff scheme. The source is taken at the
+// midpoint of the characteristic.
+struct lax_wendroff {
+  static constexpr std::size_t left_width = 1;
+  static constexpr std::size_t right_width = 1;
+  static constexpr std::size_t time_depth = 1;
+  static constexpr bool sweeps = false;
+
+  template <std::floating_point T>
+  static void advance(auto &storage, const grid_axes<T> &axes,
+                      const auto &rhs, std::size_t i, std::size_t first,
+                      std::size_t last) {
+    auto prev = storage.level(i);
+    auto next = storage.level(i + 1);
+    auto [xs, ts, t_step, x_step] = axes;
+    auto source =
+        source_row(rhs, xs, t_step / 2, ts[i] + t_step / 2, first, last);
+    auto courant = t_step / x_step;
+    simd_for(first, last, [&](std::size_t j) {
+      auto neg = T{prev[j - 1]};
+      auto pos = T{prev[j]};
+      auto far = T{prev[j + 1]};
+      next[j] = pos - courant / 2 * (far - neg) +
+                courant * courant / 2 * (far - 2 * pos + neg) +
+                source(j) * t_step;
+    });
+  }
+};
+
+// Second-order explicit three-level "cross" (leapfrog) scheme. The first
+// step is made with Lax-Wendroff.
+struct leapfrog {
+  static constexpr std::size_t left_width = 1;
+  static constexpr std::size_t right_width = 1;
+  static constexpr std::size_t time_depth = 2;
+  static constexpr bool sweeps = false;
+
+  template <std::floating_point T>
+  static void advance(auto &storage, const grid_axes<T> &axes,
+                      const auto &rhs, std::size_t i, std::size_t first,
+                      std::size_t last) {
+    if (i == 0) {
+      lax_wendroff::advance(storage, axes, rhs, i, first, last);
+      return;
+    }
+
+    auto older = storage.level(i - 1);
+    auto prev = storage.level(i);
+    auto next = storage.level(i + 1);
+    auto [xs, ts, t_step, x_step] = axes;
+    auto source = source_row(rhs, xs, T{0}, ts[i], first, last);
+    auto courant = t_step / x_step;
+    simd_for(first, last, [&](std::size_t j) {
+      next[j] = T{older[j]} - courant * (T{prev[j + 1]} - T{prev[j - 1]}) +
+                2 * t_step * source(j);
+    });
+  }
+};
+
+// Second-order "rectangle" (box) scheme. It is implicit, but the new level is
+// found by a left to right sweep because it only reaches to the left.
+struct rectangle {
+  static constexpr std::size_t left_width = 1;
+  static constexpr std::size_t right_width = 0;
+  static constexpr std::size_t time_depth = 1;
+  static constexpr bool sweeps = true;
+
+  template <std::floating_point T>
+  static void advance(auto &storage, const grid_axes<T> &axes,
+                      const auto &rhs, std::size_t i, std::size_t first,
+                      std::size_t last) {
+    auto prev = storage.level(i);
+    auto next = storage.level(i + 1);
+    auto [xs, ts, t_step, x_step] = axes;
+    auto rhs_row =
+        source_row(rhs, xs, x_step / 2, ts[i] + t_step / 2, first, last);
+    for (auto j : ranges::views::iota(first, last)) {
+      auto source = 2 * t_step * x_step * rhs_row(j);
+      auto pos = T{prev[j]};
+      auto neg = T{prev[j - 1]};
+      auto left = T{next[j - 1]};
+      next[j] = (source + x_step * (pos + neg - left) +
+                 t_step * (left - pos + neg)) /
+                (x_step + t_step);
+    }
+  }
+};
+
+// First-order implicit upwind scheme. The new level solves a lower
+// bidiagonal system, which the sweep eliminates from left to right, across
+// the processes as well. It is stable and monotone for any Courant number,
+// so the time step isn't bound by the x step.
+struct implicit_upwind {
+  static constexpr std::size_t left_width = 1;
+  static constexpr std::size_t right_width = 0;
+  static constexpr std::size_t time_depth = 1;
+  static constexpr bool sweeps = true;
+
+  template <std::floating_point T>
+  static void advance(auto &storage, const grid_axes<T> &axes,
+                      const auto &rhs, std::size_t i, std::size_t first,
+                      std::size_t last) {
+    auto prev = storage.level(i);
+    auto next = storage.level(i + 1);
+    auto [xs, ts, t_step, x_step] = axes;
+    auto source = source_row(rhs, xs, T{0}, ts[i + 1], first, last);
+    auto courant = t_step / x_step;
+    auto diagonal = 1 + courant;
+    for (auto j : ranges::views::iota(first, last))
+      next[j] = (T{prev[j]} + source(j) * t_step + courant * T{next[j - 1]}) /
+                diagonal;
+  }
+};
+
+// Crank-Nicolson in time with the upwind difference in x, second order in
+// time. The new level is a lower bidiagonal system as well and the scheme is
+// stable for any Courant number. The source is taken at the middle of the
+// step.
+struct crank_nicolson {
+  static constexpr std::size_t left_width = 1;
+  static constexpr std::size_t right_width = 0;
+  static constexpr std::size_t time_depth = 1;
+  static constexpr bool sweeps = true;
+
+  template <std::floating_point T>
+  static void advance(auto &storage, const grid_axes<T> &axes,
+                      const auto &rhs, std::size_t i, std::size_t first,
+                      std::size_t last) {
+    auto prev = storage.level(i);
+    auto next = storage.level(i + 1);
+    auto [xs, ts, t_step, x_step] = axes;
+    auto source =
+        source_row(rhs, xs, T{0}, ts[i] + t_step / 2, first, last);
+    auto half_courant = t_step / x_step / 2;
+    auto diagonal = 1 + half_courant;
+    for (auto j : ranges::views::iota(first, last)) {
+      auto pos = T{prev[j]};
+      auto neg = T{prev[j - 1]};
+      next[j] = (pos - half_courant * (pos - neg - T{next[j - 1]}) +
+                 source(j) * t_step) /
+                diagonal;
+    }
+  }
+};
+
+// The x offsets the kernels of `Scheme` sample the source at with steps of
+// `t_step`, which is zero for adaptive steps. Leapfrog takes its first step
+// with Lax-Wendroff.
+template <typename Scheme, std::floating_point T>
+auto source_offsets(T t_step, T x_step) -> std::vector<T> {
+  if constexpr (std::same_as<Scheme, lax_wendroff>)
+    return t_step != 0 ? std::vector{t_step / 2} : std::vector<T>{};
+  else if constexpr (std::same_as<Scheme, leapfrog>)
+    return {T{0}, t_step / 2};
+  else if constexpr (std::same_as<Scheme, rectangle>)
+    return {x_step / 2};
+  else
+    return {T{0}};
+}
+
+enum class scheme_kind {
+  left_corner,
+  lax_wendroff,
+  rectangle,
+  leapfrog,
+  implicit_upwind,
+  crank_nicolson
+};
+
+auto parse_scheme_kind(std::string_view name) -> scheme_kind {
+  if (name == "left-corner")
+    return scheme_kind::left_corner;
+  if (name == "lax-wendroff")
+    return scheme_kind::lax_wendroff;
+  if (name == "rectangle")
+    return scheme_kind::rectangle;
+  if (name == "leapfrog")
+    return scheme_kind::leapfrog;
+  if (name == "implicit-upwind")
+    return scheme_kind::implicit_upwind;
+  if (name == "crank-nicolson")
+    return scheme_kind::crank_nicolson;
+  throw std::invalid_argument{fmt::format("unknown scheme: {}", name)};
+}
+
+// Calls `callable` with an instance of the scheme `kind`.
+auto visit_scheme(scheme_kind kind, auto callable) {
+  switch (kind) {
+  case scheme_kind::lax_wendroff:
+    return callable(lax_wendroff{});
+  case scheme_kind::rectangle:
+    return callable(rectangle{});
+  case scheme_kind::leapfrog:
+    return callable(leapfrog{});
+  case scheme_kind::implicit_upwind:
+    return callable(implicit_upwind{});
+  case scheme_kind::crank_nicolson:
+    return callable(crank_nicolson{});
+  case scheme_kind::left_corner:
+    break;
+  }
+  return callable(left_corner{});
+}
+
+// Ghost columns of the local grid for `Scheme`.
+template <typename Scheme> struct halo_shape {
+  static_assert(!Scheme::sweeps || Scheme::right_width == 0,
+                "sweeping schemes can only reach to the left");
+
+  template <typename World>
+  halo_shape(const World &world, std::size_t time_block)
+      : has_prev(world.rank() != 0), has_next(world.rank() != world.size() - 1),
+        left(has_prev && !Scheme::sweeps ? time_block * Scheme::left_width
+                                         : Scheme::left_width),
+        right(has_next ? time_block * Scheme::right_width : 0),
+        edge(Scheme::sweeps ? Scheme::left_width
+                            : time_block * Scheme::left_width),
+        max_levels(Scheme::sweeps ? time_block + 1 : Scheme::time_depth) {}
+
+  bool has_prev;
+  bool has_next;
+  // The first process keeps the boundary values in its left ghost columns.
+  std::size_t left;
+  std::size_t right;
+  // Owned columns that go to the next process and the most levels a halo
+  // carries.
+  std::size_t edge;
+  std::size_t max_levels;
+};
+
+// Splits the columns of every step among `num_threads` threads. The calling
+// thread takes the first chunk and stays the only one that talks MPI, the
+// workers wait on a barrier between the steps.
+class thread_team {
+public:
+  explicit thread_team(std::size_t num_threads)
+      : sync(static_cast<std::ptrdiff_t>(
+            std::max<std::size_t>(num_threads, 1))) {
+    for (auto index : ranges::views::iota(std::size_t{1}, num_threads))
+      workers.emplace_back([this, index] { work(index); });
+  }
+
+  thread_team(const thread_team &) = delete;
+  thread_team &operator=(const thread_team &) = delete;
+
+  ~thread_team() {
+    if (workers.empty())
+      return;
+    stopping = true;
+    sync.arrive_and_wait();
+  }
+
+  // Calls `task(first, last)` for every chunk of [first, last) in parallel.
+  void run(std::size_t first, std::size_t last, auto task) {
+    if (workers.empty() || last <= first) {
+      task(first, last);
+      return;
+    }
+
+    // The task outlives the step, so the workers call it through a pointer
+    // and nothing is allocated per step.
+    current_task = &task;
+    call_task = [](const void *callable, std::size_t chunk_first,
+                   std::size_t chunk_last) {
+      (*static_cast<const decltype(task) *>(callable))(chunk_first,
+                                                       chunk_last);
+    };
+    range = {first, last};
+    sync.arrive_and_wait();
+    auto [chunk_first, chunk_last] = chunk(0);
+    task(chunk_first, chunk_last);
+    sync.arrive_and_wait();
+  }
+
+private:
+  auto chunk(std::size_t index) const -> std::pair<std::size_t, std::size_t> {
+    auto [first, last] = range;
+    auto num_chunks = workers.size() + 1;
+    auto size = (last - first) / num_chunks;
+    auto remainder = (last - first) % num_chunks;
+    auto chunk_first = first + index * size + std::min(index, remainder);
+    return {chunk_first, chunk_first + size + (index < remainder ? 1 : 0)};
+  }
+
+  void work(std::size_t index) {
+    while (true) {
+      sync.arrive_and_wait();
+      if (stopping)
+        return;
+      auto [chunk_first, chunk_last] = chunk(index);
+      call_task(current_task, chunk_first, chunk_last);
+      sync.arrive_and_wait();
+    }
+  }
+
+  std::barrier<> sync;
+  bool stopping = false;
+  std::pair<std::size_t, std::size_t> range;
+  const void *current_task = nullptr;
+  void (*call_task)(const void *, std::size_t, std::size_t) = nullptr;
+  std::vector<std::jthread> workers;
+};
+
+// Wall time a process spends in each phase of the solver: advancing the
+// grid, blocked in receives, sending and collecting the result, and setting
+// the solver up before all that.
+struct phase_timings {
+  using duration = std::chrono::duration<double, std::milli>;
+  duration compute{};
+  duration recv_wait{};
+  duration send{};
+  duration gather{};
+  duration setup{};
+};
+
+// Adds the wall time of its scope to `total`.
+class scoped_timer {
+public:
+  explicit scoped_timer(phase_timings::duration &accumulated)
+      : total(accumulated), begin(std::chrono::steady_clock::now()) {}
+
+  scoped_timer(const scoped_timer &) = delete;
+  scoped_timer &operator=(const scoped_timer &) = delete;
+
+  ~scoped_timer() { total += std::chrono::steady_clock::now() - begin; }
+
+private:
+  phase_timings::duration &total;
+  std::chrono::steady_clock::time_point begin;
+};
+
+// Reduces the timings of one run over the processes and formats them as a
+// JSON object with the minimum, maximum and mean of every phase in ms. Only
+// the root gets the reduced values. Without a `world`, a run without MPI,
+// the timings are those of this process alone.
+auto format_phase_timings(const mpi::communicator *world,
+                          phase_timings::duration total,
+                          const phase_timings &timings) -> std::string {
+  auto num_processes = world ? world->size() : 1;
+  auto format_phase = [&](std::string_view name,
+                          phase_timings::duration value) {
+    auto min = value.count();
+    auto max = value.count();
+    auto sum = value.count();
+    if (world) {
+      mpi::reduce(*world, value.count(), min, mpi::minimum<double>{},
+                  root_rank);
+      mpi::reduce(*world, value.count(), max, mpi::maximum<double>{},
+                  root_rank);
+      mpi::reduce(*world, value.count(), sum, std::plus<double>{}, root_rank);
+    }
+    return fmt::format(R"("{}": {{"min": {}, "max": {}, "mean": {}}})", name,
+                       min, max, sum / num_processes);
+  };
+
+  // The reductions are collective, the braced list keeps their order.
+  auto phases = std::array{
+      format_phase("total", total),
+      format_phase("compute", timings.compute),
+      format_phase("recv_wait", timings.recv_wait),
+      format_phase("send", timings.send),
+      format_phase("gather", timings.gather),
+      format_phase("setup", timings.setup),
+  };
+  return fmt::format(R"({{"processes": {}, "unit": "ms", {}}})",
+                     num_processes, fmt::join(phases, ", "));
+}
+
+// First level of the step loop and how often it leaves a checkpoint.
+struct checkpoint_schedule {
+  std::size_t start_level = 0;
+  std::size_t every = 0;
+  transfer::checkpoint_writer *writer = nullptr;
+};
+
+// The shared exchange packs the halo into slots of a shared-memory window,
+// which the neighbours on the same node copy it from, and sends nonblocking
+// messages to the others. The grids themselves stay private.
+// The rma one puts the halo into a ring in the window of the neighbour.
+enum class halo_exchange { blocking, nonblocking, shared, rma };
+
+auto parse_halo_exchange(std::string_view name) -> halo_exchange {
+  if (name == "blocking")
+    return halo_exchange::blocking;
+  if (name == "nonblocking")
+    return halo_exchange::nonblocking;
+  if (name == "shared")
+    return halo_exchange::shared;
+  if (name == "rma")
+    return halo_exchange::rma;
+  throw std::invalid_argument{
+      fmt::format("unknown halo exchange mode: {}", name)};
+}
+
+// Order in which a single process with a single thread advances the grid:
+// a level at a time or in space-time tiles.
+enum class space_time_tiling { none, trapezoids };
+
+auto parse_space_time_tiling(std::string_view name) -> space_time_tiling {
+  if (name == "none")
+    return space_time_tiling::none;
+  if (name == "trapezoids")
+    return space_time_tiling::trapezoids;
+  throw std::invalid_argument{
+      fmt::format("unknown space-time tiling: {}", name)};
+}
+
+// Walks the space-time trapezoid of the steps [t0, t1) whose step t0 + k
+// computes the columns [x0 + dx0 * k, x1 + dx1 * k) of the next level, with
+// the cache-oblivious recursion of Frigo and Strumpen. A wide trapezoid is
+// cut in two by a line of slope -reach and the left part goes first, a tall
+// one is cut in two in time and the lower part goes first, down to tiles
+// that are swept a level at a time by `visit(i, first, last)`.
+//
+// A point is visited after the points of the previous level within `reach`
+// columns and after its left neighbour. That is all the schemes read, and
+// a point of the ring of stored levels is only overwritten once the points
+// that read its old value are done.
+template <typename Visit>
+void walk_trapezoid(std::ptrdiff_t t0, std::ptrdiff_t t1, std::ptrdiff_t x0,
+                    std::ptrdiff_t dx0, std::ptrdiff_t x1, std::ptrdiff_t dx1,
+                    std::ptrdiff_t reach, Visit &visit) {
+  constexpr auto tile_columns = std::ptrdiff_t{2048};
+  constexpr auto tile_steps = std::ptrdiff_t{64};
+  auto steps = t1 - t0;
+  if (steps <= 0)
+    return;
+
+  auto width = std::max(x1 - x0, x1 - x0 + (dx1 - dx0) * steps);
+  if (width > tile_columns &&
+      2 * (x1 - x0) + (dx1 - dx0) * steps >= 4 * reach * steps) {
+    auto middle = (2 * (x0 + x1) + (2 * reach + dx0 + dx1) * steps) / 4;
+    walk_trapezoid(t0, t1, x0, dx0, middle, -reach, reach, visit);
+    walk_trapezoid(t0, t1, middle, -reach, x1, dx1, reach, visit);
+  } else if (steps > tile_steps) {
+    auto half = steps / 2;
+    walk_trapezoid(t0, t0 + half, x0, dx0, x1, dx1, reach, visit);
+    walk_trapezoid(t0 + half, t1, x0 + dx0 * half, dx0, x1 + dx1 * half, dx1,
+                   reach, visit);
+  } else {
+    for (auto k = std::ptrdiff_t{0}; k < steps; ++k) {
+      auto first = x0 + dx0 * k;
+      auto last = x1 + dx1 * k;
+      if (first < last)
+        visit(t0 + k, first, last);
+    }
+  }
+}
+
+// One problem of an ensemble: u_t + u_x = rhs(x, t) on [a, b] with the
+// initial condition and the boundary value at a. The members of an ensemble
+// share the number of x points and the time axis.
+template <std::floating_point T, typename Initial, typename Boundary,
+          typename Rhs>
+struct transfer_problem {
+  T a;
+  T b;
+  Initial initial_condition;
+  Boundary boundary_value;
+  Rhs rhs;
+  // Output file of this member of a batch written with --output.
+  std::string output_path = {};
+};
+
+// Local part of one ensemble member: its storage, its x axis and the rhs as
+// the kernels sample it.
+template <typename Storage, typename Source, typename Problem,
+          std::floating_point T>
+struct ensemble_member {
+  Storage storage;
+  std::vector<T> xs;
+  grid_axes<T> axes;
+  Source source;
+  const Problem *problem;
+};
+
+// The halo windows a part of the x axis exchanges its halo through, if any,
+// and the thread team that splits its columns. Setting them up is collective
+// and spawns threads, so a solver sets them up once and every solve reuses
+// them. Every halo published in a solve is consumed in it, so the counters
+// of the windows agree at the start of the next one.
+template <typename T> struct part_exchange {
+  template <typename World, typename Scheme>
+  part_exchange(const World &world, Scheme, std::size_t num_members,
+                std::size_t time_block, halo_exchange exchange,
+                std::size_t num_threads)
+      : team(Scheme::sweeps ? 1 : num_threads) {
+    auto ghost = halo_shape<Scheme>{world, time_block};
+    to_next_size = num_members * ghost.max_levels * ghost.edge;
+    to_prev_size =
+        num_members * ghost.max_levels * time_block * Scheme::right_width;
+    if constexpr (std::same_as<World, mpi::communicator>) {
+      if (exchange == halo_exchange::shared)
+        shared.emplace(world, to_prev_size, to_next_size);
+      if (exchange == halo_exchange::rma)
+        rma.emplace(world, to_prev_size, to_next_size);
+    } else {
+      threads.emplace(world, to_prev_size, to_next_size);
+    }
+  }
+
+  std::size_t to_prev_size = 0;
+  std::size_t to_next_size = 0;
+  std::optional<transfer::shared_halo<T>> shared;
+  std::optional<transfer::rma_halo<T>> rma;
+  std::optional<transfer::thread_halo<T>> threads;
+  thread_team team;
+};
+
+// Advances the local part of the grids of all ensemble members with `Scheme`.
+// The ghost columns of explicit schemes are a copy of the neighbours'
+// `time_block * width` edge columns. They are exchanged once per `time_block`
+// steps and the stale ghost region is recomputed locally, shrinking by the
+// stencil width per step, so the result is identical to exchanging every
+// step. Sweeping schemes need the new values of the left neighbour instead,
+// so it streams its edge columns for the whole block once the block is
+// computed.
+//
+// With the nonblocking, shared and rma exchanges the columns that don't
+// depend on the ghost region are computed while the halo is in flight.
+//
+// A single process with a single thread has no halo, with `tiling` it walks
+// the steps between checkpoints in space-time trapezoids instead, advancing
+// a cache-sized tile many steps before moving on. Every point is computed
+// from the same values as level by level, so the result is the same.
+//
+// The halo of all members goes into one message per neighbour and direction,
+// member after member, so the latency is paid once for the whole ensemble.
+//
+// The world is either an MPI communicator or a worker of a `thread_group`,
+// whose neighbours always exchange the halo through their `thread_halo`.
+// The windows and the team come set up in `resources`, made for the same
+// world, scheme, members and time block.
+template <typename World, typename Scheme, typename Member, typename T>
+auto solve_transfer_equation_impl(const World &world,
+                                  std::span<Member> members, Scheme,
+                                  std::size_t time_block,
+                                  halo_exchange exchange,
+                                  std::size_t num_threads,
+                                  space_time_tiling tiling,
+                                  checkpoint_schedule schedule,
+                                  part_exchange<T> &resources,
+                                  phase_timings &timings) {
+  constexpr auto left_width = Scheme::left_width;
+  constexpr auto right_width = Scheme::right_width;
+  constexpr auto time_depth = Scheme::time_depth;
+  constexpr auto over_mpi = std::same_as<World, mpi::communicator>;
+  // The halo carries the stored values.
+  static_assert(
+      std::same_as<T, typename decltype(Member::storage)::value_type>);
+
+  auto x_dim = members.front().axes.xs.size();
+  auto t_dim = members.front().axes.ts.size();
+  auto num_members = members.size();
+  auto ghost = halo_shape<Scheme>{world, time_block};
+  auto owned_end = x_dim - ghost.right;
+
+  // Levels sent and received at the start of a block.
+  auto halo_levels = [&](std::size_t block_start, std::size_t block_end) {
+    if constexpr (Scheme::sweeps)
+      return ranges::views::iota(block_start, block_end + 1);
+    else
+      return ranges::views::iota(block_start + 1 >= time_depth
+                                     ? block_start + 1 - time_depth
+                                     : std::size_t{0},
+                                 block_start + 1);
+  };
+
+  auto max_halo_levels = ghost.max_levels;
+  auto edge_width = ghost.edge;
+  auto to_next_size = resources.to_next_size;
+  auto from_prev_size = num_members * max_halo_levels * ghost.left;
+  auto to_prev_size = resources.to_prev_size;
+  auto from_next_size = num_members * max_halo_levels * ghost.right;
+
+  // The halo of a neighbour reached through a window is packed into and
+  // unpacked from the buffers of the window, the message buffers are left
+  // empty. The incoming halo of the rma ring moves from slot to slot.
+  using transfer::halo_side;
+  auto &shared = resources.shared;
+  auto &rma = resources.rma;
+  auto &threads = resources.threads;
+
+  // Calls `f` with the window the neighbour on `side` is reached through.
+  auto through_window = [&](halo_side side, auto f) {
+    if (threads)
+      f(*threads);
+    else if (shared && shared->shares(side))
+      f(*shared);
+    else if (rma)
+      f(*rma);
+    else
+      return false;
+    return true;
+  };
+  auto windowed = [&](halo_side side) {
+    return through_window(side, [](auto &) {});
+  };
+
+  auto message_buffer = [&](halo_side side, std::size_t size) {
+    return std::vector<T>(windowed(side) ? 0 : size);
+  };
+  auto to_next_buffer = message_buffer(halo_side::next, to_next_size);
+  auto from_prev_buffer = message_buffer(halo_side::prev, from_prev_size);
+  auto to_prev_buffer = message_buffer(halo_side::prev, to_prev_size);
+  auto from_next_buffer = message_buffer(halo_side::next, from_next_size);
+  auto to_next = std::span<T>{to_next_buffer};
+  auto to_prev = std::span<T>{to_prev_buffer};
+  auto from_prev = std::span<const T>{from_prev_buffer};
+  auto from_next = std::span<const T>{from_next_buffer};
+  through_window(halo_side::next, [&](auto &window) {
+    to_next = window.outgoing(halo_side::next);
+  });
+  through_window(halo_side::prev, [&](auto &window) {
+    to_prev = window.outgoing(halo_side::prev);
+  });
+
+  auto pack = [&](auto levels, std::size_t first, std::size_t count,
+                  std::span<T> buffer) {
+    auto k = std::size_t{0};
+    for (auto &member : members) {
+      for (auto i : levels) {
+        auto row = member.storage.level(i);
+        for (auto j : ranges::views::iota(first, first + count))
+          buffer[k++] = row[j];
+      }
+    }
+    return static_cast<int>(k);
+  };
+
+  auto unpack = [&](auto levels, std::size_t first, std::size_t count,
+                    std::span<const T> buffer) {
+    auto k = std::size_t{0};
+    for (auto &member : members) {
+      for (auto i : levels) {
+        auto row = member.storage.level(i);
+        for (auto j : ranges::views::iota(first, first + count))
+          row[j] = buffer[k++];
+      }
+    }
+  };
+
+  // Left ghost columns that aren't exchanged at the start of a block: the
+  // boundary on the first process and the streamed edge of sweeping schemes.
+  // The streamed edges of a member are `block_levels` levels long.
+  auto block_start = schedule.start_level;
+  auto block_levels = std::size_t{0};
+  auto fill_member_ghost = [&](std::size_t m, std::size_t i) {
+    auto &member = members[m];
+    auto row = member.storage.level(i);
+    if (!ghost.has_prev) {
+      auto value = member.problem->boundary_value(member.axes.ts[i]);
+      for (auto j : ranges::views::iota(std::size_t{0}, ghost.left))
+        row[j] = value;
+    } else if constexpr (Scheme::sweeps) {
+      auto first = (m * block_levels + i - block_start) * ghost.left;
+      for (auto j : ranges::views::iota(std::size_t{0}, ghost.left))
+        row[j] = from_prev[first + j];
+    }
+  };
+  auto fill_left_ghost = [&](std::size_t i) {
+    for (auto m : ranges::views::iota(std::size_t{0}, num_members))
+      fill_member_ghost(m, i);
+  };
+
+  // Sweeping schemes stream the edge columns of every level of the block, and
+  // the rolling storage doesn't keep them until the end of the block.
+  auto record_edge = [&](std::size_t i) {
+    if constexpr (Scheme::sweeps) {
+      if (ghost.has_next) {
+        for (auto m : ranges::views::iota(std::size_t{0}, num_members)) {
+          auto row = members[m].storage.level(i);
+          auto first = (m * block_levels + i - block_start) * edge_width;
+          for (auto j : ranges::views::iota(std::size_t{0}, edge_width))
+            to_next[first + j] = row[owned_end - edge_width + j];
+        }
+      }
+    }
+  };
+
+  auto commit = [&](std::size_t i) {
+    for (auto &member : members)
+      member.storage.commit(i);
+  };
+
+  // Columns of the last process past the reach of the scheme use the upwind
+  // scheme as the outflow condition.
+  //
+  // The columns of explicit schemes are split among the threads of the
+  // process, the sweep of the new level can't be split.
+  //
+  // The columns of a thread are advanced in blocks, so the row of the source
+  // is still in cache when the kernel reads it.
+  constexpr auto block_columns = std::size_t{2048};
+  auto &team = resources.team;
+  auto scheme_end = ghost.has_next ? x_dim : x_dim - right_width;
+  auto advance_columns = [&](Member &member, std::size_t i, std::size_t first,
+                             std::size_t last) {
+    auto axes = member.axes.at_step(i);
+    Scheme::advance(member.storage, axes, member.source, i, first,
+                    std::min(last, scheme_end));
+    if (last > scheme_end)
+      left_corner::advance(member.storage, axes, member.source, i,
+                           std::max(first, scheme_end), last);
+  };
+  auto advance = [&](std::size_t i, std::size_t first, std::size_t last) {
+    auto timer = scoped_timer{timings.compute};
+    // The threads go through all members of a step between two barriers.
+    team.run(first, last,
+             [&, i](std::size_t chunk_first, std::size_t chunk_last) {
+               for (auto &member : members)
+                 for (auto block = chunk_first; block < chunk_last;
+                      block += block_columns)
+                   advance_columns(member, i, block,
+                                   std::min(block + block_columns, chunk_last));
+             });
+  };
+
+  auto pending_sends = std::vector<mpi::request>{};
+  auto pending_recvs = std::vector<mpi::request>{};
+  auto pending_windows = std::vector<halo_side>{};
+  auto wait_all = [](std::vector<mpi::request> &requests,
+                     phase_timings::duration &total) {
+    if (requests.empty())
+      return;
+    auto timer = scoped_timer{total};
+    mpi::wait_all(requests.begin(), requests.end());
+    requests.clear();
+  };
+
+  auto wait_receives = [&] {
+    wait_all(pending_recvs, timings.recv_wait);
+    auto timer = scoped_timer{timings.recv_wait};
+    for (auto side : pending_windows) {
+      through_window(side, [&](auto &window) {
+        window.wait_readable(side);
+        (side == halo_side::prev ? from_prev : from_next) =
+            window.incoming(side);
+      });
+    }
+    pending_windows.clear();
+  };
+
+  // Messages to the previous process go leftward, to the next one rightward.
+  constexpr auto rightward_tag = 0;
+  constexpr auto leftward_tag = 1;
+  auto neighbour_rank = [&](halo_side side) {
+    return side == halo_side::prev ? world.rank() - 1 : world.rank() + 1;
+  };
+
+  // A window slot is written again once the neighbour is done with it.
+  auto wait_writable = [&](halo_side side) {
+    auto timer = scoped_timer{timings.send};
+    through_window(side, [&](auto &window) { window.wait_writable(side); });
+  };
+
+  auto send = [&](halo_side side, int count) {
+    auto timer = scoped_timer{timings.send};
+    if (through_window(side, [&](auto &window) {
+          window.publish(side, static_cast<std::size_t>(count));
+        }))
+      return;
+    if constexpr (over_mpi) {
+      auto dest = neighbour_rank(side);
+      auto tag = side == halo_side::prev ? leftward_tag : rightward_tag;
+      auto buffer = side == halo_side::prev ? to_prev : to_next;
+      if (exchange == halo_exchange::blocking)
+        world.send(dest, tag, buffer.data(), count);
+      else
+        pending_sends.push_back(world.isend(dest, tag, buffer.data(), count));
+    }
+  };
+
+  auto receive = [&](halo_side side, int count) {
+    auto timer = scoped_timer{timings.recv_wait};
+    if (windowed(side)) {
+      pending_windows.push_back(side);
+      return;
+    }
+    if constexpr (over_mpi) {
+      auto source = neighbour_rank(side);
+      auto tag = side == halo_side::prev ? rightward_tag : leftward_tag;
+      auto &buffer =
+          side == halo_side::prev ? from_prev_buffer : from_next_buffer;
+      if (exchange == halo_exchange::blocking)
+        world.recv(source, tag, buffer.data(), count);
+      else
+        pending_recvs.push_back(
+            world.irecv(source, tag, buffer.data(), count));
+    }
+  };
+
+  auto release = [&](halo_side side) {
+    through_window(side, [&](auto &window) { window.release(side); });
+  };
+
+  // A resumed run has the levels up to `start_level` restored.
+  if (block_start == 0) {
+    if (!ghost.has_prev)
+      fill_left_ghost(0);
+    commit(0);
+  }
+
+  // Checkpoints are taken at block starts, where the ghost regions aren't
+  // needed. Every process has finished writing the previous checkpoint
+  // before anyone starts the next one, so the slots that aren't being
+  // written always hold a level common to all processes.
+  auto last_checkpoint = block_start;
+  auto checkpoint = [&] {
+    schedule.writer->wait();
+    world.barrier();
+    auto state = std::vector<std::byte>{};
+    for (auto &member : members) {
+      auto offset = state.size();
+      state.resize(offset + member.storage.state_size(block_start));
+      member.storage.save(block_start, std::span{state}.subspan(offset));
+    }
+    schedule.writer->write(block_start, std::move(state));
+    last_checkpoint = block_start;
+  };
+
+  if (tiling == space_time_tiling::trapezoids && world.size() == 1 &&
+      num_threads == 1) {
+    auto reach = static_cast<std::ptrdiff_t>(std::max(left_width, right_width));
+    while (block_start + 1 < t_dim) {
+      if (schedule.writer && block_start >= last_checkpoint + schedule.every)
+        checkpoint();
+      auto block_end = schedule.writer
+                           ? std::min(last_checkpoint + schedule.every,
+                                      t_dim - 1)
+                           : t_dim - 1;
+      auto timer = scoped_timer{timings.compute};
+      for (auto m : ranges::views::iota(std::size_t{0}, num_members)) {
+        auto &member = members[m];
+        auto visit = [&](std::ptrdiff_t step, std::ptrdiff_t first_column,
+                         std::ptrdiff_t last_column) {
+          auto i = static_cast<std::size_t>(step);
+          auto first = static_cast<std::size_t>(first_column);
+          auto last = static_cast<std::size_t>(last_column);
+          if (first == ghost.left)
+            fill_member_ghost(m, i + 1);
+          advance_columns(member, i, first, last);
+          member.storage.commit(i + 1, first, last);
+        };
+        walk_trapezoid(static_cast<std::ptrdiff_t>(block_start),
+                       static_cast<std::ptrdiff_t>(block_end),
+                       static_cast<std::ptrdiff_t>(ghost.left), 0,
+                       static_cast<std::ptrdiff_t>(x_dim), 0, reach, visit);
+      }
+      block_start = block_end;
+    }
+    return;
+  }
+
+  for (; block_start + 1 < t_dim; block_start += time_block) {
+    auto block_end = std::min(block_start + time_block, t_dim - 1);
+    auto levels = halo_levels(block_start, block_end);
+    block_levels = levels.size();
+    if (schedule.writer && block_start >= last_checkpoint + schedule.every)
+      checkpoint();
+    wait_all(pending_sends, timings.send);
+
+    if constexpr (Scheme::sweeps) {
+      if (ghost.has_next)
+        wait_writable(halo_side::next);
+      record_edge(block_start);
+      if (ghost.has_prev) {
+        receive(halo_side::prev,
+                static_cast<int>(num_members * levels.size() * ghost.left));
+        wait_receives();
+        fill_left_ghost(block_start);
+      }
+    } else {
+      // Blocking messages pair up by rank parity: even ranks talk to the next
+      // process first and send before they receive, odd ranks talk to the
+      // previous one first and receive before they send. Two neighbours never
+      // both block in a send to each other, whatever the size of the halo.
+      auto even = world.rank() % 2 == 0;
+      auto exchange_with = [&](halo_side side) {
+        auto send_halo = [&] {
+          wait_writable(side);
+          if (side == halo_side::next)
+            send(side,
+                 pack(levels, owned_end - edge_width, edge_width, to_next));
+          else
+            send(side,
+                 pack(levels, ghost.left, time_block * right_width, to_prev));
+        };
+        auto receive_halo = [&] {
+          auto width = side == halo_side::next ? ghost.right : ghost.left;
+          receive(side, static_cast<int>(num_members * levels.size() * width));
+        };
+        if (even) {
+          send_halo();
+          receive_halo();
+        } else {
+          receive_halo();
+          send_halo();
+        }
+      };
+      for (auto side : even ? std::array{halo_side::next, halo_side::prev}
+                            : std::array{halo_side::prev, halo_side::next}) {
+        if (side == halo_side::next ? ghost.has_next : ghost.has_prev)
+          exchange_with(side);
+      }
+    }
+
+    auto unpack_ghosts = [&] {
+      if constexpr (!Scheme::sweeps) {
+        if (ghost.has_next) {
+          unpack(levels, owned_end, ghost.right, from_next);
+          release(halo_side::next);
+        }
+        if (ghost.has_prev) {
+          unpack(levels, 0, ghost.left, from_prev);
+          release(halo_side::prev);
+        }
 #ifdef DEBUG_PRINTS
-        fmt::println("rank: {}, received from: {}, value: {}", world.rank(),
-                     world.rank() - 1, result);
+        fmt::println("rank: {}, received ghosts: {} {}", world.rank(),
+                     from_prev, from_next);
 #endif
-        return result;
-      };
+      }
+    };
 
-      auto neg = [&]() {
-        if (j != 0)
-          return data[i, j - 1];
-        if (world.rank() != 0)
-          return receive();
-        return boundary_value[i];
-      }();
+    for (auto i : ranges::views::iota(block_start, block_end)) {
+      auto step = i - block_start + 1;
+      auto first = ghost.has_prev && !Scheme::sweeps ? step * left_width
+                                                     : ghost.left;
+      auto last = ghost.has_next ? x_dim - step * right_width : x_dim;
+      fill_left_ghost(i + 1);
 
-      auto pos = data[i, j];
-      data[i + 1, j] =
-          pos + rhs(xs[j], ts[i]) * t_step - (pos - neg) * t_step / x_step;
+      auto in_flight = !pending_recvs.empty() || !pending_windows.empty();
+      if (i == block_start && in_flight && !Scheme::sweeps) {
+        auto interior_first = std::clamp(ghost.left + left_width, first, last);
+        auto interior_last =
+            std::clamp(owned_end - std::min(owned_end, right_width),
+                       interior_first, last);
+        advance(i, interior_first, interior_last);
+        wait_receives();
+        unpack_ghosts();
+        advance(i, first, interior_first);
+        advance(i, interior_last, last);
+      } else {
+        if (i == block_start)
+          unpack_ghosts();
+        advance(i, first, last);
+      }
+
+      commit(i + 1);
+      record_edge(i + 1);
+    }
+
+    if constexpr (Scheme::sweeps) {
+      if (ghost.has_prev)
+        release(halo_side::prev);
+      if (ghost.has_next)
+        send(halo_side::next,
+             static_cast<int>(num_members * levels.size() * edge_width));
     }
   }
+
+  wait_all(pending_sends, timings.send);
 }
 
-template <typename T>
-using column_major_mdspan =
-    std::mdspan<T, std::dextents<std::size_t, 2>, std::layout_left>;
+// Writes the columns [first_column, first_column + n) of the output owned by
+// every process into `path` with collective MPI-IO. The root writes the
+// header and every process writes its own slab of the row-major grid. The
+// times of rows that aren't evenly spaced follow the grid.
+template <typename T, typename Layout>
+void write_binary_output(const mpi::communicator &world,
+                         const std::string &path,
+                         const transfer::output_header &header,
+                         std::span<const T> owned, std::size_t first_column,
+                         std::span<const double> times) {
+  auto check = [](int result, const char *routine) {
+    if (result != MPI_SUCCESS)
+      throw mpi::exception(routine, result);
+  };
+
+  auto t_dim = static_cast<std::size_t>(header.t_dim);
+  auto num_columns = t_dim == 0 ? std::size_t{0} : owned.size() / t_dim;
+  // MPI takes int counts and extents. The slab goes out as t_dim rows of
+  // num_columns values, so only the extents of the grid have to fit.
+  auto max_extent = static_cast<std::size_t>(std::numeric_limits<int>::max());
+  if (t_dim > max_extent || header.x_dim > max_extent)
+    throw std::runtime_error{"the output grid is too large for MPI-IO"};
+  auto local = grid_mdspan<const T, Layout>(owned.data(), t_dim, num_columns);
+  auto slab = std::vector<T>(owned.size());
+  auto slab_mdspan = grid_mdspan<T>(slab.data(), t_dim, num_columns);
+  for (auto i : ranges::views::iota(std::size_t{0}, t_dim))
+    for (auto j : ranges::views::iota(std::size_t{0}, num_columns))
+      slab_mdspan[i, j] = local[i, j];
+
+  auto file = MPI_File{};
+  check(MPI_File_open(MPI_Comm(world), path.c_str(),
+                      MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file),
+        "MPI_File_open");
+  check(MPI_File_set_size(file, 0), "MPI_File_set_size");
+
+  if (world.rank() == root_rank) {
+    check(MPI_File_write_at(file, 0, &header, sizeof(header), MPI_BYTE,
+                            MPI_STATUS_IGNORE),
+          "MPI_File_write_at");
+    auto grid_size = t_dim * header.x_dim * sizeof(T);
+    check(MPI_File_write_at(file,
+                            static_cast<MPI_Offset>(sizeof(header) + grid_size),
+                            times.data(), static_cast<int>(times.size()),
+                            MPI_DOUBLE, MPI_STATUS_IGNORE),
+          "MPI_File_write_at");
+  }
+
+  auto element_type = mpi::get_mpi_datatype<T>();
+  auto file_type = element_type;
+  auto row_type = element_type;
+  if (num_columns != 0) {
+    auto sizes = std::array{static_cast<int>(t_dim),
+                            static_cast<int>(header.x_dim)};
+    auto subsizes =
+        std::array{static_cast<int>(t_dim), static_cast<int>(num_columns)};
+    auto starts = std::array{0, static_cast<int>(first_column)};
+    check(MPI_Type_create_subarray(2, sizes.data(), subsizes.data(),
+                                   starts.data(), MPI_ORDER_C, element_type,
+                                   &file_type),
+          "MPI_Type_create_subarray");
+    check(MPI_Type_commit(&file_type), "MPI_Type_commit");
+    check(MPI_Type_contiguous(static_cast<int>(num_columns), element_type,
+                              &row_type),
+          "MPI_Type_contiguous");
+    check(MPI_Type_commit(&row_type), "MPI_Type_commit");
+  }
+
+  check(MPI_File_set_view(file, sizeof(header), element_type, file_type,
+                          "native", MPI_INFO_NULL),
+        "MPI_File_set_view");
+  auto num_rows = num_columns != 0 ? static_cast<int>(t_dim) : 0;
+  check(MPI_File_write_all(file, slab.data(), num_rows, row_type,
+                           MPI_STATUS_IGNORE),
+        "MPI_File_write_all");
+
+  if (num_columns != 0) {
+    MPI_Type_free(&row_type);
+    MPI_Type_free(&file_type);
+  }
+  check(MPI_File_close(&file), "MPI_File_close");
+}
 
-template <typename T> struct solve_result {
-  column_major_mdspan<T> mdspan;
+template <typename T, typename Layout = std::layout_right>
+struct solve_result {
+  grid_mdspan<T, Layout> mdspan;
   std::vector<T> data;
+  // Time of every row unless they are evenly spaced, empty if they are.
+  std::vector<double> times = {};
 };
 
-template <std::floating_point T>
-auto solve_transfer_equation(const mpi::communicator &world,
-                             auto initial_condition, auto boundary_value,
-                             auto rhs, T a, T b, T time, T t_step, T x_step,
-                             bool dont_collect) -> solve_result<T> {
-  auto x_dim = static_cast<std::size_t>((b - a) / x_step) + 1;
-  auto t_dim = static_cast<std::size_t>(time / t_step) + 1;
+// Types of the arithmetic and of the stored grid.
+enum class precision { single, double_precision, mixed };
 
-  auto xs = linspace(a, b, x_dim);
-  auto ts = linspace(T{0}, time, t_dim);
+auto parse_precision(std::string_view name) -> precision {
+  if (name == "float")
+    return precision::single;
+  if (name == "double")
+    return precision::double_precision;
+  if (name == "mixed")
+    return precision::mixed;
+  throw std::invalid_argument{fmt::format("unknown precision: {}", name)};
+}
+
+// Calls `callable` with the type of the arithmetic and the type of the grid
+// values of `mode`, each wrapped in std::type_identity.
+auto visit_precision(precision mode, auto callable) {
+  switch (mode) {
+  case precision::single:
+    return callable(std::type_identity<float>{}, std::type_identity<float>{});
+  case precision::mixed:
+    return callable(std::type_identity<double>{},
+                    std::type_identity<float>{});
+  case precision::double_precision:
+    break;
+  }
+  return callable(std::type_identity<double>{}, std::type_identity<double>{});
+}
+
+// A fixed time step is `tau`. An adaptive one is agreed on by all processes
+// every few steps from the stability and the accuracy bounds of their own
+// points, with `tau` as the largest step.
+enum class time_stepping { fixed, adaptive };
+
+auto parse_time_stepping(std::string_view name) -> time_stepping {
+  if (name == "fixed")
+    return time_stepping::fixed;
+  if (name == "adaptive")
+    return time_stepping::adaptive;
+  throw std::invalid_argument{fmt::format("unknown time stepping: {}", name)};
+}
+
+// The parts of the x axis are advanced by MPI processes, or by the worker
+// threads of a single process, which pass the halo through shared memory.
+enum class solver_backend { mpi, threads };
+
+auto parse_solver_backend(std::string_view name) -> solver_backend {
+  if (name == "mpi")
+    return solver_backend::mpi;
+  if (name == "threads")
+    return solver_backend::threads;
+  throw std::invalid_argument{fmt::format("unknown backend: {}", name)};
+}
+
+struct solver_options {
+  scheme_kind scheme = scheme_kind::left_corner;
+  solver_backend backend = solver_backend::mpi;
+  std::size_t time_block = 1;
+  halo_exchange exchange = halo_exchange::blocking;
+  grid_storage storage = grid_storage::full;
+  // Every `out_stride_t`-th time level and the last one go into the output,
+  // 0 keeps just the last level, and every `out_stride_x`-th x point. The
+  // rolling storage keeps nothing else.
+  std::size_t out_stride_t = 1;
+  std::size_t out_stride_x = 1;
+  // Threads per process, only the calling one talks MPI. With the threads
+  // backend every one of them is a worker with a part of the x axis.
+  std::size_t num_threads = 1;
+  // Advance a single process with a single thread in space-time tiles.
+  space_time_tiling tiling = space_time_tiling::none;
+  // Write the result into this file with MPI-IO instead of gathering it.
+  std::string output_path = {};
+  // Relative speed of every process, the x points are split evenly if empty.
+  std::vector<double> weights = {};
+  // Checkpoint every `checkpoint_every` steps into `<checkpoint_prefix>.*`
+  // and resume from the latest consistent checkpoint if `restart` is set.
+  std::string checkpoint_prefix = {};
+  std::size_t checkpoint_every = 0;
+  bool restart = false;
+  // Parareal splits the time axis among `time_slices` rows of processes.
+  // The coarse propagator steps by `coarse_t_step`, the x step if it is 0.
+  // The iterations stop once no slice start changes by more than
+  // `parareal_tolerance`, or after `parareal_iterations`, 0 being the
+  // number of slices.
+  std::size_t time_slices = 1;
+  double coarse_t_step = 0;
+  double parareal_tolerance = 0;
+  std::size_t parareal_iterations = 0;
+  // The adaptive step keeps the Courant number below `max_courant`, 1 at
+  // most for explicit schemes, and the local error of the source below
+  // `step_tolerance`. It is agreed on every `adapt_every` steps.
+  time_stepping stepping = time_stepping::fixed;
+  double max_courant = 1;
+  double step_tolerance = 1e-3;
+  std::size_t adapt_every = 1;
+};
+
+// Parareal on a (time slice, x range) process grid. Every row of the grid
+// owns a slice of the time axis and has its members on the fine levels of
+// the slice in `fine` and on coarse levels in `coarse`, which the same scheme
+// advances with larger steps. The start U of every slice is corrected as
+//
+//   U_k+1 = F(U_k') + (G(U_k) - G(U_k')),
+//
+// where F and G are the fine and the coarse propagator over the previous
+// slice and U_k' is the start of the previous iteration. After as many
+// iterations as there are slices every start is the one of the sequential
+// solution, and the coarse terms cancel exactly once the starts stop
+// changing, so a zero tolerance reproduces it bit for bit. The fine levels
+// of the last iteration are the result. Both propagators exchange their
+// halos through `resources`.
+template <typename Scheme, typename Fine, typename Coarse, typename Halo>
+void solve_parareal(const mpi::communicator &world,
+                    const mpi::communicator &time_world,
+                    const mpi::communicator &space_world,
+                    std::span<Fine> fine, std::span<Coarse> coarse,
+                    Scheme scheme, std::size_t time_block,
+                    std::size_t first_owned, std::size_t num_owned,
+                    const solver_options &options,
+                    part_exchange<Halo> &resources, phase_timings &timings) {
+  using Value = typename decltype(Fine::storage)::value_type;
+  using T = typename decltype(Fine::xs)::value_type;
+  auto slice = time_world.rank();
+  auto has_prev = slice > 0;
+  auto has_next = slice + 1 < time_world.size();
+
+  // Owned columns of the level `i` of every member, member after member.
+  auto owned_level = [&](auto members, std::size_t i) {
+    auto state = std::vector<Value>{};
+    state.reserve(members.size() * num_owned);
+    for (auto &member : members) {
+      auto level = member.storage.level(i);
+      for (auto j : ranges::views::iota(std::size_t{0}, num_owned))
+        state.push_back(level[first_owned + j]);
+    }
+    return state;
+  };
+
+  auto propagate = [&](auto members, const std::vector<Value> &start) {
+    for (auto m : ranges::views::iota(std::size_t{0}, members.size())) {
+      auto level = members[m].storage.level(0);
+      for (auto j : ranges::views::iota(std::size_t{0}, num_owned))
+        level[first_owned + j] = start[m * num_owned + j];
+    }
+    solve_transfer_equation_impl(space_world, members, scheme, time_block,
+                                 options.exchange, options.num_threads,
+                                 options.tiling, checkpoint_schedule{},
+                                 resources, timings);
+    return owned_level(members, members.front().axes.ts.size() - 1);
+  };
+
+  auto receive_start = [&](std::vector<Value> &start) {
+    auto timer = scoped_timer{timings.recv_wait};
+    time_world.recv(slice - 1, 0, start.data(), static_cast<int>(start.size()));
+  };
+
+  auto send_end = [&](const std::vector<Value> &end) {
+    auto timer = scoped_timer{timings.send};
+    time_world.send(slice + 1, 0, end.data(), static_cast<int>(end.size()));
+  };
+
+  // The coarse sweep gives the starts of the first iteration. The end of the
+  // last slice is never needed, so it runs no coarse propagator.
+  auto start = owned_level(fine, 0);
+  if (has_prev)
+    receive_start(start);
+  auto coarse_end = std::vector<Value>{};
+  if (has_next) {
+    coarse_end = propagate(coarse, start);
+    send_end(coarse_end);
+  }
+
+  auto max_iterations = options.parareal_iterations != 0
+                            ? options.parareal_iterations
+                            : static_cast<std::size_t>(time_world.size());
+  for ([[maybe_unused]] auto iteration :
+       ranges::views::iota(std::size_t{0}, max_iterations)) {
+    auto fine_end = propagate(fine, start);
+    auto previous_start = start;
+    if (has_prev)
+      receive_start(start);
+    if (has_next) {
+      auto next_coarse_end = propagate(coarse, start);
+      auto end = std::vector<Value>(start.size());
+      for (auto j : ranges::views::iota(std::size_t{0}, end.size()))
+        end[j] = T{fine_end[j]} + (T{next_coarse_end[j]} - T{coarse_end[j]});
+      send_end(end);
+      coarse_end = std::move(next_coarse_end);
+    }
+
+    auto change = T{0};
+    for (auto j : ranges::views::iota(std::size_t{0}, start.size()))
+      change = std::max(change, std::abs(T{start[j]} - T{previous_start[j]}));
+    auto max_change = T{0};
+    mpi::all_reduce(world, change, max_change, mpi::maximum<T>{});
+    if (max_change <= static_cast<T>(options.parareal_tolerance))
+      break;
+  }
+}
+
+// Stacks the grids of the time slices, which the first process of every
+// slice has, on the first slice. The last level of a slice is the first one
+// of the next and is left out.
+template <typename Value, typename Layout>
+auto gather_time_slices(const mpi::communicator &time_world,
+                        std::vector<solve_result<Value, Layout>> parts,
+                        std::size_t t_dim, std::size_t x_dim)
+    -> std::vector<solve_result<Value, Layout>> {
+  auto is_last_slice = time_world.rank() + 1 == time_world.size();
+  auto results = std::vector<solve_result<Value, Layout>>{};
+  for (auto &&part : parts) {
+    auto levels = get_num_time_points(part.mdspan) - (is_last_slice ? 0 : 1);
+    auto rows = std::vector<Value>(levels * x_dim);
+    for (auto i : ranges::views::iota(std::size_t{0}, levels))
+      for (auto j : ranges::views::iota(std::size_t{0}, x_dim))
+        rows[i * x_dim + j] = part.mdspan[i, j];
+
+    auto gathered = std::vector<std::vector<Value>>{};
+    mpi::gather(time_world, rows, gathered, root_rank);
+    if (time_world.rank() != root_rank)
+      continue;
+
+    auto data = std::vector<Value>(t_dim * x_dim);
+    auto mdspan = grid_mdspan<Value, Layout>(data.data(), t_dim, x_dim);
+    auto first_level = std::size_t{0};
+    for (auto &&slice_rows : gathered) {
+      auto slice_levels = slice_rows.size() / x_dim;
+      for (auto i : ranges::views::iota(std::size_t{0}, slice_levels))
+        for (auto j : ranges::views::iota(std::size_t{0}, x_dim))
+          mdspan[first_level + i, j] = slice_rows[i * x_dim + j];
+      first_level += slice_levels;
+    }
+    assert(first_level == t_dim);
+    results.push_back(solve_result<Value, Layout>{
+        .mdspan = mdspan,
+        .data = std::move(data),
+    });
+  }
+  return results;
+}
+
+// Time axis of an adaptive run. Every `adapt_every` steps each process bounds
+// the next step over its share of the x points of every problem, by the
+// Courant number and by the local error tau^2 / 2 * |f_t + f_x| of the source
+// along the characteristic, the derivative taken over one x step. The
+// processes agree on the smallest bound and the steps left to `time` are
+// spread evenly, so there is no short last step. Without a `world`, a run
+// without MPI, this process bounds it over all the points. The velocity is 1
+// and only the rhs bounds the step, so the axis is known before the grid is
+// advanced.
+template <std::floating_point T, typename Problem>
+auto adaptive_time_axis(const mpi::communicator *world,
+                        std::span<const Problem> problems, std::size_t x_dim,
+                        T time, T max_step, T max_courant, T x_step,
+                        const solver_options &options) -> std::vector<T> {
+  auto share = world ? transfer::split_evenly(
+                           x_dim, static_cast<std::size_t>(world->size()),
+                           static_cast<std::size_t>(world->rank()))
+                     : transfer::index_range{0, x_dim};
+  auto first = share.first;
+  auto last = share.first + share.size;
+  auto axes = std::vector<std::vector<T>>{};
+  for (auto &&problem : problems)
+    axes.push_back(linspace(problem.a, problem.b, x_dim));
+
+  auto tolerance = static_cast<T>(options.step_tolerance);
+  auto local_bound = [&](T t) {
+    auto max_derivative = T{0};
+    auto current = std::vector<T>(share.size);
+    for (auto m : ranges::views::iota(std::size_t{0}, problems.size())) {
+      auto xs = std::span<const T>{axes[m]};
+      // The rows of the source live until its next call.
+      auto here = source_row(problems[m].rhs, xs, T{0}, t, first, last);
+      for (auto j : ranges::views::iota(first, last))
+        current[j - first] = here(j);
+      auto ahead =
+          source_row(problems[m].rhs, xs, -x_step, t + x_step, first, last);
+      for (auto j : ranges::views::iota(first, last))
+        max_derivative = std::max(
+            max_derivative, std::abs(ahead(j) - current[j - first]) / x_step);
+    }
+    auto bound = std::min(max_step, max_courant * x_step);
+    if (max_derivative > 0)
+      bound = std::min(bound, std::sqrt(2 * tolerance / max_derivative));
+    return bound;
+  };
+
+  auto ts = std::vector<T>{T{0}};
+  while (ts.back() < time) {
+    auto bound = local_bound(ts.back());
+    auto step = bound;
+    if (world)
+      mpi::all_reduce(*world, bound, step, mpi::minimum<T>{});
+    auto remaining = time - ts.back();
+    auto steps_left =
+        static_cast<std::size_t>(std::ceil(remaining / step));
+    step = remaining / static_cast<T>(steps_left);
+    for ([[maybe_unused]] auto k :
+         ranges::views::iota(std::size_t{0}, options.adapt_every)) {
+      if (steps_left-- <= 1) {
+        ts.push_back(time);
+        break;
+      }
+      ts.push_back(ts.back() + step);
+    }
+  }
+  return ts;
+}
+
+// Solves every problem of the ensemble. The ensemble shares the grid
+// decomposition, the steps and the halo messages. The grid keeps `Value`s,
+// which may be narrower than the type T of the axes and the arithmetic, e.g.
+// float values to halve the memory traffic and the messages.
+//
+// The solver is set up once and solves as many times as needed: the
+// constructor agrees on the time axis, splits the grid and allocates the
+// local grids of the members, which the process or the worker owning them
+// touches first. Every `solve` starts over from the initial condition in the
+// same grids, so the repeated solves of --measure don't pay for the setup.
+template <std::floating_point T, typename Problem,
+          std::floating_point Value = T, typename Layout = std::layout_right>
+class transfer_solver {
+public:
+  // Collective over `world`, which the threads backend goes without.
+  // `problems` must outlive the solver.
+  transfer_solver(std::optional<mpi::communicator> comm,
+                  std::span<const Problem> ensemble, T time, T tau, T h,
+                  solver_options run_options, bool skip_collect)
+      : world(std::move(comm)), problems(ensemble), t_step(tau), x_step(h),
+        options(std::move(run_options)), dont_collect(skip_collect) {
+    auto num_x_points = [&](const Problem &problem) {
+      return static_cast<std::size_t>((problem.b - problem.a) / x_step) + 1;
+    };
+    x_dim = num_x_points(problems.front());
+    if (ranges::any_of(problems, [&](const Problem &problem) {
+          return num_x_points(problem) != x_dim;
+        }))
+      throw std::invalid_argument{
+          "the members of an ensemble must have the same number of x points"};
+
+    adaptive = options.stepping == time_stepping::adaptive;
+    if (adaptive && (options.scheme == scheme_kind::leapfrog ||
+                     !(options.max_courant > 0) ||
+                     !(options.step_tolerance > 0)))
+      throw std::invalid_argument{
+          "the adaptive time step needs a two-level scheme, a positive "
+          "Courant number and a positive tolerance"};
+    // Explicit schemes are unstable past a Courant number of 1.
+    auto max_courant = visit_scheme(options.scheme, [&](auto scheme) {
+      auto courant = static_cast<T>(options.max_courant);
+      return decltype(scheme)::sweeps ? courant : std::min(courant, T{1});
+    });
+    ts = adaptive ? adaptive_time_axis(world ? &*world : nullptr, problems,
+                                       x_dim, time, t_step, max_courant,
+                                       x_step, options)
+                  : linspace(T{0}, time,
+                             static_cast<std::size_t>(time / t_step) + 1);
+    auto t_dim = ts.size();
+    num_members = problems.size();
+
+    // With Parareal the rows of the process grid split the time axis and
+    // every row splits the x axis like a whole run would.
+    auto space_world = world;
+    slice = transfer::index_range{0, t_dim - 1};
+    threaded = options.backend == solver_backend::threads;
+    if (threaded &&
+        (options.time_slices > 1 || !options.checkpoint_prefix.empty() ||
+         !options.output_path.empty() || !options.weights.empty()))
+      throw std::invalid_argument{
+          "the threads backend runs in a single process, without Parareal, "
+          "checkpoints, --output and process weights"};
+    if (options.time_slices > 1) {
+      auto num_slices = static_cast<int>(options.time_slices);
+      if (world->size() % num_slices != 0)
+        throw std::invalid_argument{fmt::format(
+            "{} processes can't be split into {} time slices", world->size(),
+            num_slices)};
+      if (t_dim - 1 < options.time_slices)
+        throw std::invalid_argument{"there are fewer time steps than slices"};
+      if (options.scheme == scheme_kind::leapfrog ||
+          options.storage != grid_storage::full || options.out_stride_t != 1 ||
+          !options.checkpoint_prefix.empty() || !options.output_path.empty() ||
+          !options.weights.empty())
+        throw std::invalid_argument{
+            "Parareal needs a two-level scheme and the full storage of every "
+            "level, without checkpoints, --output and process weights"};
+
+      auto grid = mpi::cartesian_communicator{
+          *world, mpi::cartesian_topology{
+                      std::vector<int>{num_slices, world->size() / num_slices},
+                      std::vector<bool>(2)}};
+      space_world = mpi::cartesian_communicator{grid, std::vector<int>{1}};
+      time_world = mpi::cartesian_communicator{grid, std::vector<int>{0}};
+      slice = transfer::split_evenly(
+          t_dim - 1, options.time_slices,
+          static_cast<std::size_t>(time_world->rank()));
+    }
+
+    // The workers of the threads backend split the x axis like the processes
+    // do, every one of them gets some points.
+    num_parts = threaded
+                    ? std::clamp<std::size_t>(options.num_threads, 1, x_dim)
+                    : static_cast<std::size_t>(space_world->size());
+    decomposition = transfer::decompose(x_dim, num_parts, options.weights);
+    if (time_world && ranges::any_of(decomposition, [](auto range) {
+          return range.size == 0;
+        }))
+      throw std::invalid_argument{"Parareal needs points on every process"};
+
+    min_per_process = ranges::min(
+        decomposition |
+        ranges::views::transform([](auto range) { return range.size; }) |
+        ranges::views::filter([](auto size) { return size > 0; }));
+
+    // Every x point of the output is one of every `out_stride_x` points.
+    output_x_dim = (x_dim - 1) / options.out_stride_x + 1;
+
+    // The output rows are evenly spaced unless the run is adaptive or the
+    // stride doesn't divide the time axis, whose last level is always output.
+    // Otherwise their times go into the output.
+    auto evenly_spaced = !adaptive && options.out_stride_t != 0 &&
+                         (t_dim - 1) % options.out_stride_t == 0;
+    if (evenly_spaced) {
+      output_t_step = t_step * static_cast<T>(options.out_stride_t);
+    } else {
+      for (auto i : select_output_levels(t_dim, options.out_stride_t, false))
+        output_times.push_back(static_cast<double>(ts[i]));
+    }
+
+    if (threaded) {
+      group = std::make_unique<transfer::thread_group>(num_parts);
+      workers = std::make_unique<thread_team>(num_parts);
+      parts.resize(num_parts);
+      run_workers([&](std::size_t rank) {
+        parts[rank] = visit_scheme(options.scheme, [&](auto scheme) {
+          return prepare(scheme,
+                         transfer::thread_world{*group, static_cast<int>(rank)},
+                         decomposition[rank]);
+        });
+      });
+      return;
+    }
+
+    owned_range =
+        decomposition[static_cast<std::size_t>(space_world->rank())];
+    // Processes without points are left out, so they don't sit in the
+    // pipeline.
+    solver_world = space_world->split(owned_range.size > 0 ? 0 : 1);
+    if (owned_range.size > 0)
+      parts.push_back(visit_scheme(options.scheme, [&](auto scheme) {
+        return prepare(scheme, *solver_world, owned_range);
+      }));
+  }
+
+  transfer_solver(const transfer_solver &) = delete;
+  transfer_solver &operator=(const transfer_solver &) = delete;
+
+  // Collective like the constructor. The parts of the workers tear down
+  // their halos together, so every worker drops its own.
+  ~transfer_solver() {
+    if (workers)
+      run_workers([&](std::size_t rank) { parts[rank] = nullptr; });
+  }
+
+  // Collective over the world of the constructor. Returns the grid of every
+  // member on the root.
+  auto solve(phase_timings &timings)
+      -> std::vector<solve_result<Value, Layout>> {
+    if (parts.empty())
+      return {};
+
+    // The number of output levels and the sampled owned columns of every
+    // part of the x axis, in order.
+    auto output_t_dim = std::size_t{0};
+    auto gathered = std::vector<std::vector<Value>>{};
+    if (threaded) {
+      auto levels = std::vector<std::size_t>(num_parts);
+      auto worker_timings = std::vector<phase_timings>(num_parts);
+      gathered.resize(num_parts);
+      run_workers([&](std::size_t rank) {
+        std::tie(levels[rank], gathered[rank]) =
+            parts[rank](worker_timings[rank]);
+      });
+
+      // The slowest worker holds up the others.
+      auto slowest = [&](auto phase) {
+        return ranges::max(worker_timings | ranges::views::transform(phase));
+      };
+      timings.compute += slowest(&phase_timings::compute);
+      timings.recv_wait += slowest(&phase_timings::recv_wait);
+      timings.send += slowest(&phase_timings::send);
+      if (dont_collect)
+        return {};
+      output_t_dim = levels.front();
+    } else {
+      auto [levels, owned] = parts.front()(timings);
+      if (dont_collect)
+        return {};
+
+      auto timer = scoped_timer{timings.gather};
+      if (!options.output_path.empty()) {
+        auto first_output_column =
+            (owned_range.first + options.out_stride_x - 1) /
+            options.out_stride_x;
+        auto member_size = owned.size() / num_members;
+        for (auto m : ranges::views::iota(std::size_t{0}, num_members)) {
+          auto header = transfer::output_header{
+              .element_size = sizeof(Value),
+              .t_dim = levels,
+              .x_dim = output_x_dim,
+              .a = static_cast<double>(problems[m].a),
+              .b = static_cast<double>(problems[m].b),
+              .tau = static_cast<double>(output_t_step),
+              .h = static_cast<double>(
+                  x_step * static_cast<T>(options.out_stride_x)),
+          };
+          auto path = problems[m].output_path.empty()
+                          ? options.output_path
+                          : problems[m].output_path;
+          write_binary_output<Value, Layout>(
+              *solver_world, path, header,
+              std::span<const Value>{owned}.subspan(m * member_size,
+                                                    member_size),
+              first_output_column, output_times);
+        }
+        return {};
+      }
+
+      mpi::gather(*solver_world, owned, gathered, root_rank);
+      if (solver_world->rank() != root_rank)
+        return {};
+      output_t_dim = levels;
+    }
+
+    auto timer = scoped_timer{timings.gather};
+
+#ifdef DEBUG_PRINTS
+    fmt::println("gathered from number of parts: {}", gathered.size());
+    for (auto &&[rank, received] : ranges::views::enumerate(gathered)) {
+      fmt::println("from part: {}, data: {}", rank, received);
+    }
+#endif
+    auto results = std::vector<solve_result<Value, Layout>>(num_members);
+    for (auto m : ranges::views::iota(std::size_t{0}, num_members)) {
+      auto final = std::vector<Value>(output_t_dim * output_x_dim);
+      auto mdspan = grid_mdspan<Value, Layout>(final.data(), output_t_dim,
+                                               output_x_dim);
+
+      auto offset = std::size_t{0};
+      for (auto &&vals : gathered) {
+        auto member_size = vals.size() / num_members;
+        auto num_columns = member_size / output_t_dim;
+        auto part = grid_mdspan<const Value, Layout>(
+            vals.data() + m * member_size, output_t_dim, num_columns);
+        for (auto i : ranges::views::iota(std::size_t{0}, output_t_dim))
+          for (auto j : ranges::views::iota(std::size_t{0}, num_columns))
+            mdspan[i, offset + j] = part[i, j];
+        offset += num_columns;
+      }
+
+      assert(offset == output_x_dim);
+      results[m] = solve_result<Value, Layout>{
+          .mdspan = mdspan,
+          .data = std::move(final),
+      };
+    }
+
+    if (time_world)
+      results = gather_time_slices(*time_world, std::move(results), ts.size(),
+                                   output_x_dim);
+    for (auto &result : results)
+      result.times = output_times;
+    return results;
+  }
+
+private:
+  // The number of output levels and the sampled owned columns of every
+  // member.
+  using part_result = std::pair<std::size_t, std::vector<Value>>;
+  using part_solver = std::function<part_result(phase_timings &)>;
 
-  auto min_per_process = 1;
-  auto per_process =
-      std::max<std::size_t>(x_dim / world.size(), min_per_process);
-
-  auto num_for_this_process = [&]() {
-    auto rank = world.rank();
-    if (rank == world.size() - 1)
-      return x_dim - per_process * rank;
-    if (per_process * rank > x_dim)
-      return std::size_t{0};
-    if (per_process * (rank + 1) > x_dim)
-      return x_dim - per_process * rank;
-    return per_process;
-  }();
+  // Runs `task(rank)` for every worker, each on its own thread of the team,
+  // and rethrows the first exception of any of them. The calling thread is
+  // the worker 0.
+  void run_workers(auto task) {
+    auto errors = std::vector<std::exception_ptr>(num_parts);
+    workers->run(0, num_parts, [&](std::size_t first, std::size_t last) {
+      for (auto rank : ranges::views::iota(first, last)) {
+        try {
+          task(rank);
+        } catch (...) {
+          errors[rank] = std::current_exception();
+        }
+      }
+    });
+    for (auto &error : errors) {
+      if (error)
+        std::rethrow_exception(error);
+    }
+  }
+
+  // Sets up the members of the part `owned_range` of the x axis for the
+  // process or the worker `solver_world`. Returns the solver of the part,
+  // which owns the members.
+  template <typename Scheme, typename World>
+  auto prepare(Scheme scheme, const World &part_world,
+               transfer::index_range part_range) -> part_solver {
+    constexpr auto over_mpi = std::same_as<World, mpi::communicator>;
+    auto starting_index = part_range.first;
+    auto num_for_this_process = part_range.size;
+    // Ghost regions of explicit schemes are copied from the neighbours'
+    // owned points only, so `time_block` is limited by the smallest process.
+    auto max_time_block =
+        Scheme::sweeps || part_world.size() == 1
+            ? options.time_block
+            : min_per_process /
+                  std::max(Scheme::left_width, Scheme::right_width);
+    auto time_block = std::clamp<std::size_t>(
+        options.time_block, 1, std::max<std::size_t>(max_time_block, 1));
+    auto ghost = halo_shape<Scheme>{part_world, time_block};
+    auto local_x_dim = ghost.left + num_for_this_process + ghost.right;
+    // Every worker of the threads backend is a single thread.
+    auto resources = std::make_shared<part_exchange<Value>>(
+        part_world, scheme, num_members, time_block, options.exchange,
+        over_mpi ? options.num_threads : 1);
+    auto columns = sample_columns(ghost.left, num_for_this_process,
+                                  starting_index, options.out_stride_x);
+    auto slice_ts =
+        std::span<const T>{ts}.subspan(slice.first, slice.size + 1);
 
 #ifdef DEBUG_PRINTS
-  fmt::println("rank: {}, num_for_this_process: {}", world.rank(),
-               num_for_this_process);
+    fmt::println("rank: {}, num_for_this_process: {}, time_block: {}",
+                 part_world.rank(), num_for_this_process, time_block);
 #endif
 
-  auto data_for_process = std::vector<T>(num_for_this_process * t_dim);
+    // The first process' ghost columns hold the boundary and have no x.
+    auto local_xs = [&](const Problem &problem) {
+      auto xs = linspace(problem.a, problem.b, x_dim);
+      return ranges::views::iota(std::size_t{0}, local_x_dim) |
+             ranges::views::transform([&](auto j) {
+               auto index = static_cast<std::ptrdiff_t>(starting_index + j) -
+                            static_cast<std::ptrdiff_t>(ghost.left);
+               return index < 0 ? problem.a + static_cast<T>(index) * x_step
+                                : xs[static_cast<std::size_t>(index)];
+             }) |
+             ranges::to_vector;
+    };
+
+    auto prepare_with = [&](auto make_storage) -> part_solver {
+      using source_type = decltype(make_source(
+          std::declval<const Problem &>().rhs, std::span<const T>{},
+          std::span<const T>{}));
+      using member_type =
+          ensemble_member<decltype(make_storage()), source_type, Problem, T>;
+      // The members stay where they are for the lifetime of the solver of
+      // the part, which may be copied.
+      auto members = std::make_shared<std::vector<member_type>>();
+      members->reserve(num_members);
+      auto offsets = source_offsets<Scheme>(adaptive ? T{0} : t_step, x_step);
+      for (auto &&problem : problems) {
+        // The source refers to the x axis, which stays where it is when the
+        // vector is moved into the member.
+        auto member_xs = local_xs(problem);
+        auto source = make_source(problem.rhs, std::span<const T>{member_xs},
+                                  std::span<const T>{offsets});
+        auto &member = members->emplace_back(member_type{
+            .storage = make_storage(),
+            .xs = std::move(member_xs),
+            .axes = {},
+            .source = std::move(source),
+            .problem = &problem,
+        });
+        member.axes = grid_axes<T>{.xs = member.xs,
+                                   .ts = slice_ts,
+                                   .t_step = adaptive ? T{0} : t_step,
+                                   .x_step = x_step};
+      }
+
+      using coarse_storage = rolling_storage<Value, Layout>;
+      using coarse_type =
+          ensemble_member<coarse_storage, source_type, Problem, T>;
+      auto coarse_ts = std::make_shared<std::vector<T>>();
+      auto coarse = std::make_shared<std::vector<coarse_type>>();
+      if (time_world) {
+        auto coarse_t_step = options.coarse_t_step > 0
+                                 ? static_cast<T>(options.coarse_t_step)
+                                 : x_step;
+        auto coarse_steps = std::max<std::size_t>(
+            static_cast<std::size_t>(std::ceil(
+                (slice_ts.back() - slice_ts.front()) / coarse_t_step)),
+            1);
+        *coarse_ts =
+            linspace(slice_ts.front(), slice_ts.back(), coarse_steps + 1);
+        coarse->reserve(num_members);
+        auto coarse_step = (slice_ts.back() - slice_ts.front()) /
+                           static_cast<T>(coarse_steps);
+        auto offsets = source_offsets<Scheme>(coarse_step, x_step);
+        for (auto &&problem : problems) {
+          auto member_xs = local_xs(problem);
+          auto source = make_source(problem.rhs, std::span<const T>{member_xs},
+                                    std::span<const T>{offsets});
+          auto &member = coarse->emplace_back(coarse_type{
+              .storage = coarse_storage(local_x_dim, Scheme::time_depth + 1,
+                                        {}, columns),
+              .xs = std::move(member_xs),
+              .axes = {},
+              .source = std::move(source),
+              .problem = &problem,
+          });
+          member.axes = grid_axes<T>{
+              .xs = member.xs,
+              .ts = *coarse_ts,
+              .t_step = coarse_step,
+              .x_step = x_step};
+        }
+      }
+
+      return [this, scheme, part_world, members, coarse_ts, coarse, resources,
+              time_block, ghost, local_x_dim, starting_index,
+              num_for_this_process](phase_timings &part_timings) {
+        for (auto &member : *members) {
+          auto initial_level = member.storage.level(0);
+          for (auto j : ranges::views::iota(std::size_t{0}, local_x_dim))
+            initial_level[j] = member.problem->initial_condition(member.xs[j]);
+        }
+
+        auto state_size = [&](std::size_t level) {
+          return ranges::accumulate(
+              *members |
+                  ranges::views::transform([&](const member_type &member) {
+                    return member.storage.state_size(level);
+                  }),
+              std::size_t{0});
+        };
+
+        auto schedule = checkpoint_schedule{.every = options.checkpoint_every};
+        auto writer = std::optional<transfer::checkpoint_writer>{};
+        if (!options.checkpoint_prefix.empty()) {
+          // Every member's interval and expressions, so that a restart of a
+          // different problem on the same grid isn't taken for this one.
+          auto problems_hash = std::uint64_t{0};
+          for (auto &&problem : problems)
+            problems_hash = transfer::hash_values({
+                problems_hash,
+                std::bit_cast<std::uint64_t>(static_cast<double>(problem.a)),
+                std::bit_cast<std::uint64_t>(static_cast<double>(problem.b)),
+                transfer::hash_text(problem.initial_condition.text()),
+                transfer::hash_text(problem.boundary_value.text()),
+                transfer::hash_text(problem.rhs.text()),
+            });
+          auto fingerprint = transfer::hash_values({
+              x_dim,
+              ts.size(),
+              num_members,
+              problems_hash,
+              std::bit_cast<std::uint64_t>(static_cast<double>(t_step)),
+              std::bit_cast<std::uint64_t>(static_cast<double>(x_step)),
+              sizeof(T),
+              sizeof(Value),
+              static_cast<std::uint64_t>(options.scheme),
+              static_cast<std::uint64_t>(options.storage),
+              static_cast<std::uint64_t>(options.stepping),
+              std::bit_cast<std::uint64_t>(options.max_courant),
+              std::bit_cast<std::uint64_t>(options.step_tolerance),
+              options.adapt_every,
+              options.out_stride_t,
+              options.out_stride_x,
+              static_cast<std::uint64_t>(part_world.size()),
+              starting_index,
+              local_x_dim,
+          });
+
+          auto resumed_level = std::optional<std::uint64_t>{};
+          if (options.restart) {
+            // The threads backend has no checkpoints.
+            if constexpr (over_mpi)
+              resumed_level = transfer::find_latest_checkpoint(
+                  part_world, options.checkpoint_prefix, fingerprint);
+            if (!resumed_level)
+              throw std::runtime_error{
+                  fmt::format("no consistent checkpoint of this run in {}",
+                              options.checkpoint_prefix)};
+            auto state = std::vector<std::byte>(state_size(*resumed_level));
+            transfer::read_checkpoint(options.checkpoint_prefix,
+                                      part_world.rank(), *resumed_level,
+                                      fingerprint, state);
+            auto offset = std::size_t{0};
+            for (auto &member : *members) {
+              auto size = member.storage.state_size(*resumed_level);
+              member.storage.restore(
+                  *resumed_level, std::span{state}.subspan(offset, size));
+              offset += size;
+            }
+            schedule.start_level = *resumed_level;
+          }
+
+          writer.emplace(options.checkpoint_prefix, part_world.rank(),
+                         fingerprint, resumed_level);
+          schedule.writer = &*writer;
+        }
+
+        if (time_world) {
+          if constexpr (over_mpi)
+            solve_parareal(*world, *time_world, part_world,
+                           std::span{*members}, std::span{*coarse}, scheme,
+                           time_block, ghost.left, num_for_this_process,
+                           options, *resources, part_timings);
+        } else {
+          solve_transfer_equation_impl(part_world, std::span{*members},
+                                       scheme, time_block, options.exchange,
+                                       over_mpi ? options.num_threads : 1,
+                                       options.tiling, schedule, *resources,
+                                       part_timings);
+        }
+        if (writer)
+          writer->wait();
+
+        // Sampled owned columns of the output levels, member after member.
+        auto owned = std::vector<Value>{};
+        for (auto &member : *members) {
+          auto part = member.storage.collect();
+          owned.insert(owned.end(), part.begin(), part.end());
+        }
+        return part_result{members->front().storage.num_output_levels(),
+                           std::move(owned)};
+      };
+    };
+
+    auto levels = select_output_levels(slice_ts.size(), options.out_stride_t,
+                                       dont_collect);
+    if (options.storage == grid_storage::rolling)
+      return prepare_with([&] {
+        return rolling_storage<Value, Layout>(
+            local_x_dim, Scheme::time_depth + 1, levels, columns);
+      });
+    return prepare_with([&] {
+      return full_storage<Value, Layout>(slice_ts.size(), local_x_dim, levels,
+                                         columns);
+    });
+  }
+
+  // Empty with the threads backend, which makes no MPI calls.
+  std::optional<mpi::communicator> world;
+  std::span<const Problem> problems;
+  T t_step;
+  T x_step;
+  solver_options options;
+  bool dont_collect;
+
+  std::size_t x_dim = 0;
+  bool adaptive = false;
+  std::vector<T> ts;
+  std::size_t num_members = 0;
+  // The rows of the Parareal process grid and the slice of this row.
+  std::optional<mpi::communicator> time_world;
+  transfer::index_range slice = {};
+  bool threaded = false;
+  std::size_t num_parts = 0;
+  std::vector<transfer::index_range> decomposition;
+  std::size_t min_per_process = 0;
+  std::size_t output_x_dim = 0;
+  // Spacing of evenly spaced output rows, or else the time of every row.
+  T output_t_step = 0;
+  std::vector<double> output_times;
+
+  // The processes with points and the part of this one.
+  std::optional<mpi::communicator> solver_world;
+  transfer::index_range owned_range = {};
+  std::unique_ptr<transfer::thread_group> group;
+  // The threads of the workers, which live as long as the solver.
+  std::unique_ptr<thread_team> workers;
+  // The part of this process, or the part of every worker.
+  std::vector<part_solver> parts;
+};
+
+// Multi-dimensional advection u_t + sum_d c_d du/dx_d = f on [a, b]^N. The
+// grid is split among a Cartesian process grid. Every process keeps two time
+// levels of its box surrounded by one layer of ghost points and only receives
+// the face on the upwind side of each dimension from its neighbour.
+
+// Calls `f(index)` for every multi-index in [0, sizes) in row-major order.
+template <std::size_t N>
+void for_each_index(const std::array<std::size_t, N> &sizes, auto f) {
+  auto index = std::array<std::size_t, N>{};
+  auto total = ranges::accumulate(sizes, std::size_t{1}, std::multiplies{});
+  for ([[maybe_unused]] auto i : ranges::views::iota(std::size_t{0}, total)) {
+    f(std::as_const(index));
+    for (auto d = N; d-- > 0;) {
+      if (++index[d] < sizes[d])
+        break;
+      index[d] = 0;
+    }
+  }
+}
+
+template <std::size_t N> struct process_box {
+  std::array<std::size_t, N> first;
+  std::array<std::size_t, N> size;
+};
+
+template <std::size_t N>
+auto make_process_box(const std::vector<int> &process_dims,
+                      const std::vector<int> &coordinates,
+                      std::size_t num_points) -> process_box<N> {
+  auto box = process_box<N>{};
+  for (auto d : ranges::views::iota(std::size_t{0}, N)) {
+    auto range = transfer::split_evenly(
+        num_points, static_cast<std::size_t>(process_dims[d]),
+        static_cast<std::size_t>(coordinates[d]));
+    box.first[d] = range.first;
+    box.size[d] = range.size;
+  }
+  return box;
+}
+
+// Last time level of the N-dimensional solution in row-major order.
+template <std::floating_point T> struct advection_result {
+  std::vector<std::size_t> extents;
+  std::vector<T> data;
+};
+
+// The grid keeps `Value`s, the arithmetic is done in T.
+template <std::floating_point T, std::size_t N,
+          std::floating_point Value = T>
+auto solve_advection(const mpi::communicator &world, auto initial_condition,
+                     auto boundary_value, auto rhs, T a, T b, T time,
+                     T t_step, T x_step, const std::array<T, N> &velocity,
+                     bool dont_collect, phase_timings &timings)
+    -> advection_result<Value> {
+  auto num_points = static_cast<std::size_t>((b - a) / x_step) + 1;
+  auto t_dim = static_cast<std::size_t>(time / t_step) + 1;
+  auto xs = linspace(a, b, num_points);
+  auto ts = linspace(T{0}, time, t_dim);
+
+  auto process_dims = std::vector<int>(N, 0);
+  mpi::cartesian_dimensions(world.size(), process_dims);
+  auto cart = mpi::cartesian_communicator{
+      world, mpi::cartesian_topology{process_dims, std::vector<bool>(N)}};
+  auto box = make_process_box<N>(process_dims, cart.coordinates(cart.rank()),
+                                 num_points);
+
+  // Local box with a ghost layer on both sides of every dimension.
+  auto extents = std::array<std::size_t, N>{};
+  auto strides = std::array<std::size_t, N>{};
+  auto local_size = std::size_t{1};
+  for (auto d = N; d-- > 0;) {
+    extents[d] = box.size[d] + 2;
+    strides[d] = local_size;
+    local_size *= extents[d];
+  }
+
+  auto offset_of = [&](const std::array<std::size_t, N> &index) {
+    auto offset = std::size_t{0};
+    for (auto d : ranges::views::iota(std::size_t{0}, N))
+      offset += index[d] * strides[d];
+    return offset;
+  };
+
+  // Upwind neighbour of every point in each dimension and its weight.
+  auto upwind_offset = std::array<std::ptrdiff_t, N>{};
+  auto courant = std::array<T, N>{};
+  for (auto d : ranges::views::iota(std::size_t{0}, N)) {
+    auto stride = static_cast<std::ptrdiff_t>(strides[d]);
+    upwind_offset[d] = velocity[d] >= 0 ? -stride : stride;
+    courant[d] = std::abs(velocity[d]) * t_step / x_step;
+  }
+
+  // Faces of the owned box that are sent downwind and the ghost layers they
+  // are received into, described by subarray datatypes of the local box.
+  struct face_exchange {
+    MPI_Datatype send_type;
+    MPI_Datatype recv_type;
+    int source;
+    int dest;
+    std::size_t dimension;
+    std::size_t ghost_layer;
+  };
+
+  auto make_face_type = [&](std::size_t d, std::size_t layer) {
+    auto sizes = std::array<int, N>{};
+    auto subsizes = std::array<int, N>{};
+    auto starts = std::array<int, N>{};
+    for (auto k : ranges::views::iota(std::size_t{0}, N)) {
+      sizes[k] = static_cast<int>(extents[k]);
+      subsizes[k] = k == d ? 1 : static_cast<int>(box.size[k]);
+      starts[k] = k == d ? static_cast<int>(layer) : 1;
+    }
+    auto type = MPI_Datatype{};
+    MPI_Type_create_subarray(static_cast<int>(N), sizes.data(),
+                             subsizes.data(), starts.data(), MPI_ORDER_C,
+                             mpi::get_mpi_datatype<Value>(), &type);
+    MPI_Type_commit(&type);
+    return type;
+  };
+
+  auto faces = std::vector<face_exchange>{};
+  for (auto d : ranges::views::iota(std::size_t{0}, N)) {
+    if (velocity[d] == 0)
+      continue;
+    auto downwind = velocity[d] > 0;
+    auto [source, dest] =
+        cart.shifted_ranks(static_cast<int>(d), downwind ? 1 : -1);
+    auto send_layer = downwind ? box.size[d] : std::size_t{1};
+    auto ghost_layer = downwind ? std::size_t{0} : box.size[d] + 1;
+    faces.push_back({.send_type = make_face_type(d, send_layer),
+                     .recv_type = make_face_type(d, ghost_layer),
+                     .source = source,
+                     .dest = dest,
+                     .dimension = d,
+                     .ghost_layer = ghost_layer});
+  }
+
+  auto local_xs = std::array<std::vector<T>, N>{};
+  for (auto d : ranges::views::iota(std::size_t{0}, N))
+    local_xs[d] = std::vector<T>(xs.begin() + box.first[d],
+                                 xs.begin() + box.first[d] + box.size[d]);
+
+  auto point = [&](const auto &owned_index) {
+    auto x = std::array<T, N>{};
+    for (auto d : ranges::views::iota(std::size_t{0}, N))
+      x[d] = local_xs[d][owned_index[d]];
+    return x;
+  };
+
+  auto shifted = [](auto index) {
+    for (auto &i : index)
+      ++i;
+    return index;
+  };
+
+  auto current = std::vector<Value>(local_size);
+  auto next = std::vector<Value>(local_size);
+  for_each_index(box.size, [&](const auto &index) {
+    current[offset_of(shifted(index))] = initial_condition(point(index));
+  });
+
+  // Rows along the last dimension are contiguous and are vectorized.
+  auto row_sizes = std::array<std::size_t, N - 1>{};
+  std::copy_n(box.size.begin(), N - 1, row_sizes.begin());
+  auto row_length = box.size[N - 1];
 
-  auto mdspan = column_major_mdspan<T>(data_for_process.data(), t_dim,
-                                       num_for_this_process);
-  auto starting_index = world.rank() * per_process;
-  auto initial_values =
-      ranges::views::transform(xs, initial_condition) | ranges::to_vector;
-  for (auto x_index :
-       ranges::views::iota(std::size_t{0}, num_for_this_process)) {
-    mdspan[0, x_index] = initial_values[starting_index + x_index];
+  // The source of the row starting at `x` and level i. Batch functions are
+  // evaluated for the whole row at once.
+  auto row_source = std::vector<T>(row_length);
+  auto source_of_row = [&](const std::array<T, N> &x, std::size_t i) {
+    if constexpr (batch_function<decltype(rhs), T>) {
+      auto arguments = std::array<transfer::batch_argument<T>, N + 1>{};
+      for (auto d : ranges::views::iota(std::size_t{0}, N - 1))
+        arguments[d] = transfer::batch_argument<T>::uniform(x[d]);
+      arguments[N - 1] =
+          transfer::batch_argument<T>::varying(local_xs[N - 1]);
+      arguments[N] = transfer::batch_argument<T>::uniform(ts[i]);
+      rhs.evaluate(std::span<const transfer::batch_argument<T>>{arguments},
+                   std::span<T>{row_source});
+      return [&](std::size_t j) { return row_source[j]; };
+    } else {
+      return [&, x, i](std::size_t j) {
+        auto x_p = x;
+        x_p[N - 1] = local_xs[N - 1][j];
+        return rhs(x_p, ts[i]);
+      };
+    }
+  };
+
+  auto fill_inflow_boundary = [&](const face_exchange &face, T value) {
+    auto face_sizes = box.size;
+    face_sizes[face.dimension] = 1;
+    for_each_index(face_sizes, [&](const auto &index) {
+      auto ghost_index = shifted(index);
+      ghost_index[face.dimension] = face.ghost_layer;
+      current[offset_of(ghost_index)] = value;
+    });
+  };
+
+  for (auto i : ranges::views::iota(std::size_t{0}, t_dim - 1)) {
+    // The send and the receive of a face are one call, it's all waiting.
+    for (auto &&face : faces) {
+      auto timer = scoped_timer{timings.recv_wait};
+      MPI_Sendrecv(current.data(), 1, face.send_type, face.dest, 0,
+                   current.data(), 1, face.recv_type, face.source, 0, cart,
+                   MPI_STATUS_IGNORE);
+      if (face.source == MPI_PROC_NULL)
+        fill_inflow_boundary(face, boundary_value(ts[i]));
+    }
+
+    auto timer = scoped_timer{timings.compute};
+    for_each_index(row_sizes, [&](const auto &row) {
+      auto index = std::array<std::size_t, N>{};
+      std::copy(row.begin(), row.end(), index.begin());
+      auto source = source_of_row(point(index), i);
+      auto first = offset_of(shifted(index));
+      simd_for(0, row_length, [&](auto j) {
+        auto p = first + j;
+        auto flux = T{0};
+        for (auto d : ranges::views::iota(std::size_t{0}, N)) {
+          auto upwind = static_cast<std::size_t>(
+              static_cast<std::ptrdiff_t>(p) + upwind_offset[d]);
+          flux += courant[d] * (T{current[p]} - T{current[upwind]});
+        }
+        next[p] = T{current[p]} - flux + t_step * source(j);
+      });
+    });
+    std::swap(current, next);
   }
 
-  {
-    auto boundary_values =
-        ranges::views::transform(ts, boundary_value) | ranges::to_vector;
-    solve_transfer_equation_impl(
-        world, mdspan, rhs, std::span{boundary_values},
-        std::span{xs}.subspan(starting_index,
-                              starting_index + num_for_this_process),
-        std::span{ts}.subspan(starting_index,
-                              starting_index + num_for_this_process),
-        t_step, x_step);
+  for (auto &&face : faces) {
+    MPI_Type_free(&face.send_type);
+    MPI_Type_free(&face.recv_type);
   }
 
   if (dont_collect)
     return {};
 
-  auto gathered = std::vector<std::vector<T>>{};
-  mpi::gather(world, data_for_process, gathered, root_rank);
+  auto timer = scoped_timer{timings.gather};
+  auto owned = std::vector<Value>{};
+  owned.reserve(ranges::accumulate(box.size, std::size_t{1},
+                                   std::multiplies{}));
+  for_each_index(box.size, [&](const auto &index) {
+    owned.push_back(current[offset_of(shifted(index))]);
+  });
 
-  if (world.rank() != root_rank)
+  auto gathered = std::vector<std::vector<Value>>{};
+  mpi::gather(cart, owned, gathered, root_rank);
+
+  if (cart.rank() != root_rank)
     return {};
 
-#ifdef DEBUG_PRINTS
-  fmt::println("rank: {}, gathered from number of processes: {}", world.rank(),
-               gathered.size());
-  for (auto &&[rank, received] : ranges::views::enumerate(gathered)) {
-    fmt::println("from rank: {}, data: {}", rank, received);
+  auto global_extents = std::vector<std::size_t>(N, num_points);
+  auto global_strides = std::array<std::size_t, N>{};
+  auto global_size = std::size_t{1};
+  for (auto d = N; d-- > 0;) {
+    global_strides[d] = global_size;
+    global_size *= num_points;
   }
-#endif
-  auto final = std::vector<T>();
-
-  for (auto &&vals : gathered)
-    ranges::copy(vals, std::back_inserter(final));
 
-  assert(final.size() == t_dim * x_dim);
+  auto data = std::vector<Value>(global_size);
+  for (auto &&[rank, values] : ranges::views::enumerate(gathered)) {
+    auto part = make_process_box<N>(
+        process_dims, cart.coordinates(static_cast<int>(rank)), num_points);
+    auto next_value = values.begin();
+    for_each_index(part.size, [&](const auto &index) {
+      auto offset = std::size_t{0};
+      for (auto d : ranges::views::iota(std::size_t{0}, N))
+        offset += (part.first[d] + index[d]) * global_strides[d];
+      data[offset] = *next_value++;
+    });
+  }
 
-  return solve_result<T>{
-      .mdspan = column_major_mdspan<T>(final.data(), t_dim, x_dim),
-      .data = std::move(final),
+  return advection_result<Value>{
+      .extents = std::move(global_extents),
+      .data = std::move(data),
   };
 }
 
+// One problem of a --batch file: its domain and the expressions of its
+// initial condition u(x, 0), boundary value u(a, t) and rhs f(x, t).
+struct batch_entry {
+  double a;
+  double b;
+  std::string initial;
+  std::string boundary;
+  std::string rhs;
+};
+
+// Reads a batch file with one problem per line given as `key=value` pairs,
+// e.g. `a=0 b=1 rhs="x * t"`. Values with spaces are put in double quotes.
+// Missing keys take the values of the command line, empty lines and lines
+// starting with `#` are skipped.
+auto read_batch(const std::string &path, const batch_entry &defaults)
+    -> std::vector<batch_entry> {
+  auto file = std::ifstream{path};
+  if (!file)
+    throw std::runtime_error{
+        fmt::format("can't open the batch file: {}", path)};
+
+  auto entries = std::vector<batch_entry>{};
+  for (auto line = std::string{}; std::getline(file, line);) {
+    auto tokens = std::istringstream{line};
+    auto key = std::string{};
+    if (!(tokens >> std::ws) || tokens.peek() == '#' ||
+        tokens.peek() == std::char_traits<char>::eof())
+      continue;
+
+    auto entry = defaults;
+    while (std::getline(tokens >> std::ws, key, '=')) {
+      auto value = std::string{};
+      if (!(tokens >> std::quoted(value)))
+        throw std::invalid_argument{fmt::format(
+            "expected key=value in the batch file, got {}", key)};
+      if (key == "a")
+        entry.a = std::stod(value);
+      else if (key == "b")
+        entry.b = std::stod(value);
+      else if (key == "initial")
+        entry.initial = value;
+      else if (key == "boundary")
+        entry.boundary = value;
+      else if (key == "rhs")
+        entry.rhs = value;
+      else
+        throw std::invalid_argument{
+            fmt::format("unknown key in the batch file: {}", key)};
+    }
+    entries.push_back(std::move(entry));
+  }
+  return entries;
+}
+
 } // namespace
 
 auto main(int argc, char **argv) -> int {
-  auto env = mpi::environment{argc, argv};
-  const auto world = mpi::communicator{};
-
   auto desc = po::options_description{"allowed options"};
 
   auto default_num_points = 16;
@@ -226,11 +2815,112 @@ auto main(int argc, char **argv) -> int {
                                     std::numbers::pi / default_num_points))(
       "t", po::value<double>()->default_value(1.0), "upper bound for time")(
       "tau", po::value<double>()->default_value(0.25),
-      "time value step")("samples", po::value<uint32_t>()->default_value(16))(
-      "measure", "measure performance")("verbose", "enable verbose output");
+      "time value step, the largest one with --time-stepping adaptive")(
+      "initial", po::value<std::string>(),
+      "initial condition u(x, 0), cos(pi * x) by default, the coordinates of "
+      "the multi-dimensional problem are x, y and z")(
+      "boundary", po::value<std::string>()->default_value("exp(-t)"),
+      "boundary value u(a, t) at the inflow boundary")(
+      "rhs", po::value<std::string>(),
+      "right hand side f(x, t), x + t by default")(
+      "samples", po::value<uint32_t>()->default_value(16))(
+      "scheme", po::value<std::string>()->default_value("left-corner"),
+      "difference scheme: left-corner, lax-wendroff, rectangle, leapfrog, "
+      "implicit-upwind or crank-nicolson (the last two are stable for any "
+      "tau)")(
+      "time-block", po::value<std::size_t>()->default_value(1),
+      "number of time steps advanced per halo exchange")(
+      "exchange", po::value<std::string>()->default_value("blocking"),
+      "halo exchange mode: blocking, nonblocking, shared (packed halo "
+      "slots in a shared-memory window between the processes of a node, "
+      "nonblocking messages otherwise) or rma (one-sided puts into a ring "
+      "of halos)")(
+      "threads", po::value<std::size_t>()->default_value(1),
+      "number of threads per process")(
+      "backend", po::value<std::string>()->default_value("mpi"),
+      "who advances the parts of the x axis: mpi (processes) or threads "
+      "(--threads workers of a single process passing the halo through "
+      "shared memory, MPI isn't started)")(
+      "tiling", po::value<std::string>()->default_value("none"),
+      "space-time tiling of a single process with a single thread: none or "
+      "trapezoids (cache-oblivious, many steps per cache-sized tile)")(
+      "storage", po::value<std::string>()->default_value("full"),
+      "grid storage: full or rolling (two time levels and the output "
+      "samples)")(
+      "out-stride-t", po::value<std::size_t>()->default_value(1),
+      "output every n-th time level and the last one, 0 outputs only the "
+      "last one; only --storage rolling saves the memory of the others")(
+      "out-stride-x", po::value<std::size_t>()->default_value(1),
+      "output every n-th x point; only --storage rolling saves the memory "
+      "of the others")(
+      "weights", po::value<std::vector<double>>()->multitoken(),
+      "relative speed of every process, the x points are split in "
+      "proportion, processes without points are left out")(
+      "weights-file", po::value<std::string>(),
+      "read the process weights from a file, e.g. measured throughput")(
+      "checkpoint", po::value<std::string>(),
+      "prefix of the per-process checkpoint files, written in the "
+      "background")(
+      "checkpoint-every", po::value<std::size_t>()->default_value(1000),
+      "number of time steps between checkpoints")(
+      "restart", "resume from the latest checkpoint every process has")(
+      "output", po::value<std::string>(),
+      "write the result into a binary file with MPI-IO, read it back with "
+      "transfer-reader, problem i of a batch goes to <output>.i")(
+      "batch", po::value<std::string>(),
+      "solve every problem of a file with `a=... b=... initial=... "
+      "boundary=... rhs=...` lines, problems with the same number of points "
+      "share the halo messages")(
+      "time-slices", po::value<std::size_t>()->default_value(1),
+      "solve with Parareal on a grid of this many rows of processes, every "
+      "row owning a slice of the time axis")(
+      "coarse-tau", po::value<double>(),
+      "time step of the Parareal coarse propagator, h by default")(
+      "parareal-tolerance", po::value<double>()->default_value(0.0),
+      "stop Parareal once no slice start changes by more than this, 0 "
+      "reproduces the sequential solution")(
+      "parareal-iterations", po::value<std::size_t>()->default_value(0),
+      "upper bound on the Parareal iterations, the number of slices by "
+      "default")(
+      "time-stepping", po::value<std::string>()->default_value("fixed"),
+      "fixed or adaptive: a step schedule precomputed from the rhs alone "
+      "before the grid is advanced, the processes agree on a step every "
+      "--adapt-every steps of it and every output row starts with its time")(
+      "cfl", po::value<double>()->default_value(1.0),
+      "largest Courant number of the adaptive step, at most 1 for explicit "
+      "schemes")(
+      "step-tolerance", po::value<double>()->default_value(1e-3),
+      "largest local error of the source per adaptive step")(
+      "adapt-every", po::value<std::size_t>()->default_value(1),
+      "number of steps between the adaptive step agreements")(
+      "precision", po::value<std::string>()->default_value("double"),
+      "floating point types: float, double or mixed (float grid and "
+      "messages, double arithmetic)")(
+      "dims", po::value<std::size_t>()->default_value(1),
+      "number of space dimensions, 2 and 3 solve the multi-dimensional "
+      "upwind problem on a Cartesian process grid")(
+      "velocity",
+      po::value<std::vector<double>>()->multitoken()->default_value(
+          std::vector<double>{1.0}, "1"),
+      "velocity components of the multi-dimensional problem")(
+      "measure", "measure performance")(
+      "timings",
+      "with --measure, print the mean time of every solver phase per sample "
+      "reduced across the processes as JSON, the samples collect the result")(
+      "measure-setup",
+      "with --measure, also print the time of setting the solvers up, which "
+      "happens once before the samples and is left out of them")(
+      "verbose", "enable verbose output");
 
   auto vm = po::variables_map{};
-  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+  // There are no short options, so negative velocity components aren't
+  // mistaken for them.
+  po::store(po::command_line_parser(argc, argv)
+                .options(desc)
+                .style(po::command_line_style::unix_style ^
+                       po::command_line_style::allow_short)
+                .run(),
+            vm);
   po::notify(vm);
 
   if (vm.count("help")) {
@@ -243,19 +2933,111 @@ auto main(int argc, char **argv) -> int {
   auto h = vm.at("h").as<double>();
   auto tau = vm.at("tau").as<double>();
   auto t = vm.at("t").as<double>();
+  auto options = solver_options{
+      .scheme = parse_scheme_kind(vm.at("scheme").as<std::string>()),
+      .backend = parse_solver_backend(vm.at("backend").as<std::string>()),
+      .time_block = vm.at("time-block").as<std::size_t>(),
+      .exchange = parse_halo_exchange(vm.at("exchange").as<std::string>()),
+      .storage = parse_grid_storage(vm.at("storage").as<std::string>()),
+      .out_stride_t = vm.at("out-stride-t").as<std::size_t>(),
+      .out_stride_x =
+          std::max<std::size_t>(vm.at("out-stride-x").as<std::size_t>(), 1),
+      .num_threads = vm.at("threads").as<std::size_t>(),
+      .tiling = parse_space_time_tiling(vm.at("tiling").as<std::string>()),
+      .output_path =
+          vm.count("output") ? vm.at("output").as<std::string>() : "",
+      .time_slices = vm.at("time-slices").as<std::size_t>(),
+      .coarse_t_step =
+          vm.count("coarse-tau") ? vm.at("coarse-tau").as<double>() : 0.0,
+      .parareal_tolerance = vm.at("parareal-tolerance").as<double>(),
+      .parareal_iterations = vm.at("parareal-iterations").as<std::size_t>(),
+      .stepping =
+          parse_time_stepping(vm.at("time-stepping").as<std::string>()),
+      .max_courant = vm.at("cfl").as<double>(),
+      .step_tolerance = vm.at("step-tolerance").as<double>(),
+      .adapt_every =
+          std::max<std::size_t>(vm.at("adapt-every").as<std::size_t>(), 1),
+  };
+
+  // Every sample of --measure would write the checkpoints of a whole run.
+  if (vm.count("checkpoint") && vm.count("measure"))
+    throw std::invalid_argument{
+        "--checkpoint and --measure are mutually exclusive"};
+  if (vm.count("checkpoint")) {
+    options.checkpoint_prefix = vm.at("checkpoint").as<std::string>();
+    options.checkpoint_every =
+        std::max<std::size_t>(vm.at("checkpoint-every").as<std::size_t>(), 1);
+    options.restart = vm.count("restart") != 0;
+  } else if (vm.count("restart")) {
+    throw std::invalid_argument{"--restart requires --checkpoint"};
+  }
+
+  if (vm.count("weights") && vm.count("weights-file"))
+    throw std::invalid_argument{
+        "--weights and --weights-file are mutually exclusive"};
+  if (vm.count("weights"))
+    options.weights = vm.at("weights").as<std::vector<double>>();
+  if (vm.count("weights-file"))
+    options.weights =
+        transfer::read_weights(vm.at("weights-file").as<std::string>());
+
+  // Only the mpi backend starts MPI. --backend threads runs in this process
+  // alone, which reduces the adaptive time axis and the timings by itself
+  // and is the root that prints.
+  auto env = std::optional<mpi::environment>{};
+  auto world = std::optional<mpi::communicator>{};
+  if (options.backend == solver_backend::mpi) {
+    env.emplace(argc, argv, mpi::threading::funneled);
+    world.emplace();
+  }
+  auto is_root = !world || world->rank() == root_rank;
+
+  if (options.backend == solver_backend::mpi && options.num_threads > 1 &&
+      env->thread_level() < mpi::threading::funneled)
+    throw std::runtime_error{"MPI library doesn't support funneled threads"};
 
-  auto solve_function = [&](bool dont_collect) {
-    return solve_transfer_equation(
-        world, [](auto x) { return std::cos(std::numbers::pi * x); },
-        [](auto t) { return std::exp(-t); },
-        [](auto x, auto t) { return x + t; }, a, b, t, tau, h, dont_collect);
+  auto timings = phase_timings{};
+  auto report_timings = vm.count("timings") != 0;
+
+  auto dims = vm.at("dims").as<std::size_t>();
+  auto mode = parse_precision(vm.at("precision").as<std::string>());
+  auto expression_or = [&](const char *name, std::string fallback) {
+    return vm.count(name) ? vm.at(name).as<std::string>() : fallback;
   };
+  auto boundary = vm.at("boundary").as<std::string>();
+
+  if (vm.count("batch") && dims > 1)
+    throw std::invalid_argument{"--batch solves one-dimensional problems"};
+  if (options.stepping == time_stepping::adaptive && dims > 1)
+    throw std::invalid_argument{
+        "the adaptive time step is only supported in one dimension"};
+  if ((options.out_stride_t != 1 || options.out_stride_x != 1) && dims > 1)
+    throw std::invalid_argument{
+        "output strides are only supported in one dimension"};
+  if (options.backend == solver_backend::threads && dims > 1)
+    throw std::invalid_argument{
+        "the threads backend is only supported in one dimension"};
+  if (vm.count("measure-setup") && dims > 1)
+    throw std::invalid_argument{
+        "--measure-setup is only supported in one dimension"};
+  auto defaults =
+      batch_entry{.a = a,
+                  .b = b,
+                  .initial = expression_or("initial", "cos(pi * x)"),
+                  .boundary = boundary,
+                  .rhs = expression_or("rhs", "x + t")};
+  // The multi-dimensional problem compiles expressions of its own below.
+  auto batch = std::vector<batch_entry>{};
+  if (vm.count("batch"))
+    batch = read_batch(vm.at("batch").as<std::string>(), defaults);
+  else if (dims == 1)
+    batch.push_back(defaults);
 
   auto measure_time =
       [&](auto callable) -> std::chrono::duration<double, std::milli> {
     auto run_once = [&] {
       auto begin_time = std::chrono::high_resolution_clock::now();
-      callable(true);
+      callable(!report_timings);
       auto end_time = std::chrono::high_resolution_clock::now();
       return std::chrono::duration<double>{end_time - begin_time}.count();
     };
@@ -273,33 +3055,220 @@ auto main(int argc, char **argv) -> int {
   fmt::println("raw data: {}", data);
 #endif
 
-  if (vm.count("measure")) {
-    auto duration = measure_time(solve_function);
-    if (world.rank() != root_rank)
-      return EXIT_SUCCESS;
+  auto print_duration = [&](auto duration) {
+    if (report_timings) {
+      auto num_samples = vm.at("samples").as<uint32_t>();
+      auto per_sample = phase_timings{
+          .compute = timings.compute / num_samples,
+          .recv_wait = timings.recv_wait / num_samples,
+          .send = timings.send / num_samples,
+          .gather = timings.gather / num_samples,
+          .setup = timings.setup,
+      };
+      auto formatted = format_phase_timings(world ? &*world : nullptr,
+                                            duration, per_sample);
+      if (is_root)
+        fmt::println("{}", formatted);
+      return;
+    }
+    if (!is_root)
+      return;
+    if (vm.count("measure-setup")) {
+      if (vm.count("verbose"))
+        fmt::println("setting up the solver took {} ms",
+                     timings.setup.count());
+      else
+        fmt::println("{}", timings.setup.count());
+    }
     if (vm.count("verbose"))
       fmt::println("solving the pde took {} ms", duration.count());
     else
       fmt::println("{}", duration.count());
+  };
+
+  if (dims > 1) {
+    auto velocity = vm.at("velocity").as<std::vector<double>>();
+    if (velocity.size() == 1)
+      velocity.resize(dims, velocity.front());
+    if (velocity.size() != dims)
+      throw std::invalid_argument{
+          fmt::format("expected {} velocity components, got {}", dims,
+                      velocity.size())};
+
+    // The multi-dimensional problem generalizes the one-dimensional one with
+    // u(x, 0) = prod_d cos(pi x_d) and f(x, t) = sum_d x_d + t by default.
+    auto solve_in = [&]<std::size_t N, typename T, typename Value>(
+                        std::integral_constant<std::size_t, N>,
+                        std::type_identity<T>, std::type_identity<Value>) {
+      using expression = transfer::expression<T>;
+      auto components = std::array<T, N>{};
+      std::ranges::transform(velocity | ranges::views::take(N),
+                             components.begin(),
+                             [](double v) { return static_cast<T>(v); });
+
+      auto coordinates = std::vector<std::string>{"x", "y", "z"};
+      coordinates.resize(N);
+      auto default_initial = coordinates |
+                             ranges::views::transform([](auto &&name) {
+                               return fmt::format("cos(pi * {})", name);
+                             }) |
+                             ranges::to_vector;
+      auto initial = expression{
+          expression_or("initial",
+                        fmt::format("{}", fmt::join(default_initial, " * "))),
+          coordinates};
+      auto rhs_variables = coordinates;
+      rhs_variables.push_back("t");
+      auto rhs = expression{
+          expression_or("rhs", fmt::format("t + {}",
+                                           fmt::join(coordinates, " + "))),
+          rhs_variables};
+      auto boundary_value = expression{boundary, {"t"}};
+
+      auto solve_nd_function = [&](bool dont_collect) {
+        return solve_advection<T, N, Value>(
+            *world,
+            [&](const std::array<T, N> &x) {
+              return initial.evaluate(std::span<const T>{x});
+            },
+            boundary_value, rhs, static_cast<T>(a), static_cast<T>(b),
+            static_cast<T>(t), static_cast<T>(tau), static_cast<T>(h),
+            components, dont_collect, timings);
+      };
+
+      if (vm.count("measure")) {
+        print_duration(measure_time(solve_nd_function));
+        return;
+      }
+
+      auto [extents, data] = solve_nd_function(false);
+      if (!is_root)
+        return;
+
+      // One line per row along the last dimension.
+      auto values = std::span<const Value>{data};
+      for (auto offset = std::size_t{0}; offset < values.size();
+           offset += extents.back())
+        fmt::println("{}",
+                     fmt::join(values.subspan(offset, extents.back()), ", "));
+    };
+
+    visit_precision(mode, [&](auto compute, auto value) {
+      switch (dims) {
+      case 2:
+        solve_in(std::integral_constant<std::size_t, 2>{}, compute, value);
+        break;
+      case 3:
+        solve_in(std::integral_constant<std::size_t, 3>{}, compute, value);
+        break;
+      default:
+        throw std::invalid_argument{
+            fmt::format("unsupported number of dimensions: {}", dims)};
+      }
+    });
     return EXIT_SUCCESS;
   }
 
-  auto [mdspan, data] = solve_function(false);
-  auto t_dim = get_num_time_points(mdspan);
-  auto x_dim = get_num_x_points(mdspan);
+  auto solve_batch = [&]<typename T, typename Value>(
+                         std::type_identity<T>, std::type_identity<Value>) {
+    // The expressions are compiled once, before any of the samples.
+    using expression = transfer::expression<T>;
+    using problem_type =
+        transfer_problem<T, expression, expression, expression>;
+    // Problems with the same number of x points are solved as one ensemble.
+    auto ensembles = std::map<std::size_t, std::vector<std::size_t>>{};
+    auto ensemble_problems =
+        std::map<std::size_t, std::vector<problem_type>>{};
+    for (auto index : ranges::views::iota(std::size_t{0}, batch.size())) {
+      auto &entry = batch[index];
+      auto num_points =
+          static_cast<std::size_t>((static_cast<T>(entry.b) -
+                                    static_cast<T>(entry.a)) /
+                                   static_cast<T>(h)) +
+          1;
+      ensembles[num_points].push_back(index);
+      ensemble_problems[num_points].push_back(problem_type{
+          .a = static_cast<T>(entry.a),
+          .b = static_cast<T>(entry.b),
+          .initial_condition = expression{entry.initial, {"x"}},
+          .boundary_value = expression{entry.boundary, {"t"}},
+          .rhs = expression{entry.rhs, {"x", "t"}},
+          .output_path = vm.count("batch") && vm.count("output")
+                             ? fmt::format("{}.{}", options.output_path, index)
+                             : "",
+      });
+    }
+
+    // The solvers of the ensembles are set up once, the samples of --measure
+    // only repeat the solves.
+    using solver_type = transfer_solver<T, problem_type, Value>;
+    using solver_map = std::map<std::size_t, solver_type>;
+    auto set_up = [&](bool dont_collect) {
+      auto timer = scoped_timer{timings.setup};
+      auto solvers = solver_map{};
+      for (auto &&[num_points, indices] : ensembles) {
+        // Every ensemble of a batch keeps checkpoints of its own.
+        auto ensemble_options = options;
+        if (ensembles.size() > 1 && !options.checkpoint_prefix.empty())
+          ensemble_options.checkpoint_prefix =
+              fmt::format("{}.n{}", options.checkpoint_prefix, num_points);
 
-  for ([[maybe_unused]] auto i : ranges::views::iota(std::size_t{0}, t_dim)) {
-    auto time_slice =
-        ranges::views::iota(std::size_t{0}, x_dim) |
-        ranges::views::transform([&](auto j) { return mdspan[i, j]; });
-    auto formatted = fmt::format("{}", fmt::join(time_slice, ", "));
-    fmt::println("{}", formatted);
-  }
+        solvers.try_emplace(
+            num_points, world,
+            std::span<const problem_type>{ensemble_problems.at(num_points)},
+            static_cast<T>(t), static_cast<T>(tau), static_cast<T>(h),
+            ensemble_options, dont_collect);
+      }
+      return solvers;
+    };
+
+    auto solve_function = [&](solver_map &solvers) {
+      auto results = std::vector<solve_result<Value>>(batch.size());
+      for (auto &&[num_points, indices] : ensembles) {
+        auto solved = solvers.at(num_points).solve(timings);
+        for (auto k : ranges::views::iota(std::size_t{0}, solved.size()))
+          results[indices[k]] = std::move(solved[k]);
+      }
+      return results;
+    };
+
+    if (vm.count("measure")) {
+      auto solvers = set_up(!report_timings);
+      print_duration(
+          measure_time([&](bool) { return solve_function(solvers); }));
+      return;
+    }
+
+    // The grids of a batch are separated by an empty line.
+    auto solvers = set_up(false);
+    auto results = solve_function(solvers);
+    for (auto &&[index, result] : ranges::views::enumerate(results)) {
+      auto &&[mdspan, data, times] = result;
+      auto t_dim = get_num_time_points(mdspan);
+      auto x_dim = get_num_x_points(mdspan);
+      if (index != 0 && t_dim != 0)
+        fmt::println("");
+
+      for ([[maybe_unused]] auto i :
+           ranges::views::iota(std::size_t{0}, t_dim)) {
+        auto time_slice =
+            ranges::views::iota(std::size_t{0}, x_dim) |
+            ranges::views::transform([&](auto j) { return mdspan[i, j]; });
+        auto formatted = fmt::format("{}", fmt::join(time_slice, ", "));
+        if (times.empty())
+          fmt::println("{}", formatted);
+        else
+          fmt::println("{}, {}", times[i], formatted);
+      }
+    }
+  };
+
+  visit_precision(mode, solve_batch);
 
-  if (world.rank() != root_rank)
+  if (!is_root)
     return EXIT_SUCCESS;
 
-  if (world.rank() != root_rank)
+  if (!is_root)
     return EXIT_SUCCESS;
 
   return EXIT_SUCCESS;